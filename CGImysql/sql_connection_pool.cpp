@@ -7,6 +7,7 @@
 #include <pthread.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../metrics/metrics.h"
 
 using namespace std;
 
@@ -67,6 +68,7 @@ MYSQL *connection_pool::GetConnection()
 
 	if (0 == connList.size())
 		return NULL;
+	int64_t wait_start = metrics::now_ns();
 	// 信号量等待
 	reserve.wait();
 	// 加锁，防止其他线程调用对资源的修改
@@ -80,6 +82,7 @@ MYSQL *connection_pool::GetConnection()
 	++m_CurConn;
 
 	lock.unlock();
+	metrics::get_instance()->observe(METRIC_DB_WAIT, metrics::now_ns() - wait_start);
 	return con;
 }
 
@@ -0,0 +1,57 @@
+/*************************************************************
+*用户凭据存储
+*登录校验和注册只通过这个接口，具体后端在启动时选定：
+*  mysql: 原来的user表，启动时整表读入内存，注册时写回数据库
+*  file:  嵌入式的mmap哈希文件，不依赖外部服务
+*  none:  只提供静态文件，登录和注册一律失败
+*只有mysql后端会创建数据库连接池，其余后端不需要MySQL
+**************************************************************/
+
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include <string>
+
+enum CREDENTIAL_BACKEND
+{
+    CREDENTIAL_MYSQL = 0,
+    CREDENTIAL_FILE,
+    CREDENTIAL_NONE
+};
+
+class credential_store
+{
+public:
+    virtual ~credential_store() {}
+
+    // 用户名存在且密码一致
+    virtual bool verify(const std::string &name, const std::string &passwd) = 0;
+
+    // 注册新用户，用户名已存在或写入失败返回false
+    virtual bool add_user(const std::string &name, const std::string &passwd) = 0;
+
+    // 没有配置后端时使用
+    static credential_store *none();
+};
+
+class none_store : public credential_store
+{
+public:
+    bool verify(const std::string &, const std::string &)
+    {
+        return false;
+    }
+
+    bool add_user(const std::string &, const std::string &)
+    {
+        return false;
+    }
+};
+
+inline credential_store *credential_store::none()
+{
+    static none_store instance;
+    return &instance;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file_store.h"
+#include "../log/log.h"
+
+static uint32_t name_hash(const std::string &name)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+file_store::file_store(int close_log)
+{
+    m_base = NULL;
+    m_len = 0;
+    m_header = NULL;
+    m_slots = NULL;
+    m_mask = 0;
+    m_close_log = close_log;
+}
+
+file_store::~file_store()
+{
+    if (m_base)
+        munmap(m_base, m_len);
+}
+
+bool file_store::open(const char *path, uint32_t capacity)
+{
+    if (capacity < 8 || (capacity & (capacity - 1)) != 0)
+        return false;
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        LOG_ERROR("open credential file %s failed", path);
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    bool created = 0 == st.st_size;
+    if (created)
+    {
+        // 新文件按容量扩展，空槽位是空洞，不占磁盘
+        m_len = sizeof(credential_file_header) + (size_t)capacity * sizeof(credential_slot);
+        if (ftruncate(fd, m_len) < 0)
+        {
+            close(fd);
+            return false;
+        }
+    }
+    else
+        m_len = st.st_size;
+
+    m_base = (char *)mmap(NULL, m_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m_base == MAP_FAILED)
+    {
+        m_base = NULL;
+        return false;
+    }
+    m_header = (credential_file_header *)m_base;
+    m_slots = (credential_slot *)(m_base + sizeof(credential_file_header));
+
+    if (created)
+    {
+        memcpy(m_header->magic, CREDENTIAL_FILE_MAGIC, sizeof(m_header->magic));
+        m_header->slot_size = sizeof(credential_slot);
+        m_header->capacity = capacity;
+        m_header->count = 0;
+    }
+    else
+    {
+        uint32_t cap = m_header->capacity;
+        if (m_len < sizeof(credential_file_header) ||
+            memcmp(m_header->magic, CREDENTIAL_FILE_MAGIC, sizeof(m_header->magic)) != 0 ||
+            m_header->slot_size != sizeof(credential_slot) || cap < 8 || (cap & (cap - 1)) != 0 ||
+            m_len != sizeof(credential_file_header) + (size_t)cap * sizeof(credential_slot))
+        {
+            LOG_ERROR("bad credential file %s", path);
+            munmap(m_base, m_len);
+            m_base = NULL;
+            return false;
+        }
+    }
+    m_mask = m_header->capacity - 1;
+    return true;
+}
+
+credential_slot *file_store::probe(const std::string &name, uint32_t hash)
+{
+    uint32_t idx = hash & m_mask;
+    for (uint32_t i = 0; i <= m_mask; ++i)
+    {
+        credential_slot *slot = m_slots + idx;
+        if (!__atomic_load_n(&slot->used, __ATOMIC_ACQUIRE))
+            return slot;
+        if (slot->hash == hash && slot->name_len == name.size() && memcmp(slot->name, name.data(), name.size()) == 0)
+            return slot;
+        idx = (idx + 1) & m_mask;
+    }
+    return NULL;
+}
+
+bool file_store::verify(const std::string &name, const std::string &passwd)
+{
+    if (!m_base || name.size() > sizeof(m_slots->name) || passwd.size() > sizeof(m_slots->passwd))
+        return false;
+    credential_slot *slot = probe(name, name_hash(name));
+    return slot && slot->used && slot->passwd_len == passwd.size() &&
+           memcmp(slot->passwd, passwd.data(), passwd.size()) == 0;
+}
+
+bool file_store::add_user(const std::string &name, const std::string &passwd)
+{
+    if (!m_base || name.size() > sizeof(m_slots->name) || passwd.size() > sizeof(m_slots->passwd))
+        return false;
+    uint32_t hash = name_hash(name);
+
+    m_lock.lock();
+    credential_slot *slot = probe(name, hash);
+    if (!slot || slot->used)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    // 保留1/8空槽位，探测链不会太长
+    if (m_header->count + 1 > m_header->capacity - m_header->capacity / 8)
+    {
+        m_lock.unlock();
+        LOG_ERROR("credential file full, %u users", m_header->count);
+        return false;
+    }
+    slot->hash = hash;
+    slot->name_len = name.size();
+    slot->passwd_len = passwd.size();
+    memcpy(slot->name, name.data(), name.size());
+    memcpy(slot->passwd, passwd.data(), passwd.size());
+    __atomic_store_n(&slot->used, 1, __ATOMIC_RELEASE);
+    m_header->count++;
+
+    // 注册很少发生，同步落盘，进程崩溃或断电不丢账号
+    long page = sysconf(_SC_PAGESIZE);
+    char *begin = (char *)((uintptr_t)slot & ~(uintptr_t)(page - 1));
+    msync(begin, (char *)(slot + 1) - begin, MS_SYNC);
+    msync(m_base, page, MS_SYNC);
+    m_lock.unlock();
+    return true;
+}
@@ -0,0 +1,69 @@
+/*************************************************************
+*mmap哈希文件凭据存储
+*文件是一张定长的开放寻址哈希表，每个槽位128字节，整个文件mmap后直接查找
+*查找不加锁：注册时先写好用户名和密码，最后用release语义置位槽位状态
+*注册串行化，槽位只增不删，容量在建文件时确定，装载率超过7/8后拒绝注册
+**************************************************************/
+
+#ifndef FILE_STORE_H
+#define FILE_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include "credential_store.h"
+#include "../lock/locker.h"
+
+#define CREDENTIAL_FILE_MAGIC "TWCRED01"
+
+struct credential_file_header
+{
+    char magic[8];
+    uint32_t slot_size;
+    uint32_t capacity; // 槽位数，2的幂
+    uint32_t count;    // 已用槽位数
+    uint32_t reserved[11];
+};
+
+static_assert(sizeof(credential_file_header) == 64, "credential_file_header layout changed");
+
+// used最后写入，为0时其余字段无意义
+struct credential_slot
+{
+    uint32_t hash;
+    uint8_t used;
+    uint8_t name_len;
+    uint8_t passwd_len;
+    uint8_t reserved;
+    char name[56];
+    char passwd[64];
+};
+
+static_assert(sizeof(credential_slot) == 128, "credential_slot layout changed");
+
+class file_store : public credential_store
+{
+public:
+    file_store(int close_log);
+    ~file_store();
+
+    // 文件不存在时按capacity个槽位新建，已存在时校验文件头
+    bool open(const char *path, uint32_t capacity = 1 << 16);
+
+    bool verify(const std::string &name, const std::string &passwd);
+    bool add_user(const std::string &name, const std::string &passwd);
+
+private:
+    // 返回name所在槽位，不存在时返回探测到的第一个空槽位
+    credential_slot *probe(const std::string &name, uint32_t hash);
+
+private:
+    char *m_base;
+    size_t m_len;
+    credential_file_header *m_header;
+    credential_slot *m_slots;
+    uint32_t m_mask;
+    locker m_lock; // 注册互斥
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include "mysql_store.h"
+#include "../log/log.h"
+
+mysql_store::mysql_store(connection_pool *connPool, int close_log)
+{
+    m_connPool = connPool;
+    m_close_log = close_log;
+}
+
+bool mysql_store::load()
+{
+    //先从连接池中取一个连接
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+
+    //在user表中检索username，passwd数据，浏览器端输入
+    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return false;
+    }
+
+    //从表中检索完整的结果集
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return false;
+
+    //从结果集中获取下一行，将对应的用户名和密码，存入map中
+    m_lock.lock();
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+        m_users[row[0]] = row[1];
+    m_lock.unlock();
+    mysql_free_result(result);
+    return true;
+}
+
+bool mysql_store::verify(const std::string &name, const std::string &passwd)
+{
+    m_lock.lock();
+    std::map<std::string, std::string>::iterator it = m_users.find(name);
+    bool ok = it != m_users.end() && it->second == passwd;
+    m_lock.unlock();
+    return ok;
+}
+
+bool mysql_store::add_user(const std::string &name, const std::string &passwd)
+{
+    m_lock.lock();
+    bool exists = m_users.count(name) > 0;
+    m_lock.unlock();
+    if (exists)
+        return false;
+
+    // 只有注册需要数据库连接，处理其它请求时不再占用连接
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return false;
+
+    // 转义后再拼SQL
+    char esc_name[2 * 100 + 1], esc_passwd[2 * 100 + 1];
+    if (name.size() > 100 || passwd.size() > 100)
+        return false;
+    mysql_real_escape_string(mysql, esc_name, name.c_str(), name.size());
+    mysql_real_escape_string(mysql, esc_passwd, passwd.c_str(), passwd.size());
+    char order[512];
+    snprintf(order, sizeof(order), "INSERT INTO user(username, passwd) VALUES('%s','%s')", esc_name, esc_passwd);
+    LOG_DEBUG("%s", order);
+
+    m_lock.lock();
+    // 同名用户并发注册时只有一个成功
+    if (m_users.count(name) > 0 || mysql_query(mysql, order))
+    {
+        m_lock.unlock();
+        LOG_DEBUG("Insert error!");
+        return false;
+    }
+    m_users[name] = passwd;
+    m_lock.unlock();
+    return true;
+}
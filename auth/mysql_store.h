@@ -0,0 +1,34 @@
+/*************************************************************
+*MySQL凭据存储
+*启动时把user表整表读入内存，登录只查内存
+*注册时从连接池取一个连接写回数据库，成功后再加入内存
+**************************************************************/
+
+#ifndef MYSQL_STORE_H
+#define MYSQL_STORE_H
+
+#include <map>
+#include <string>
+#include "credential_store.h"
+#include "../lock/locker.h"
+#include "../CGImysql/sql_connection_pool.h"
+
+class mysql_store : public credential_store
+{
+public:
+    mysql_store(connection_pool *connPool, int close_log);
+
+    // 读取user表
+    bool load();
+
+    bool verify(const std::string &name, const std::string &passwd);
+    bool add_user(const std::string &name, const std::string &passwd);
+
+private:
+    connection_pool *m_connPool;
+    std::map<std::string, std::string> m_users;
+    locker m_lock;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*************************************************************
+*日志写入开销测试
+*每种日志写入方式在独立的子进程中运行(Log是单例，只能init一次)
+*多个线程同时写日志，统计写日志线程每条日志消耗的CPU时间以及折算到每个请求的开销
+*用法: ./bench/log_bench [线程数] [每线程日志条数] [每请求日志条数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../log/log.h"
+
+int m_close_log = 0;
+
+static int g_lines = 200000;
+
+struct mode_info
+{
+    const char *name;
+    int max_queue_size;
+    int ring_size;
+    bool deferred;
+};
+
+static const mode_info MODES[] = {
+    {"sync", 0, 0, false},
+    {"async-queue", 800, 0, false},
+    {"async-ring", 0, 1 << 20, false},
+    {"deferred", 0, 1 << 20, true},
+};
+
+static long long now_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *worker(void *arg)
+{
+    long long *cost = (long long *)arg;
+    // 与add_response中记录的响应头长度相近
+    const char *header = "HTTP/1.1 200 OK\r\nContent-Length:3168\r\nContent-Type:text/html\r\n";
+    // 线程数多于CPU核数时墙上时间包含排队，这里统计本线程消耗的CPU时间
+    long long start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < g_lines; ++i)
+    {
+        LOG_INFO("request:%s %d", header, i);
+    }
+    *cost = now_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+    return NULL;
+}
+
+// 在子进程中跑一种模式，结果写回共享内存
+static void run_mode(const mode_info &mode, int threads, double *result)
+{
+    char file[64];
+    snprintf(file, sizeof(file), "/tmp/log_bench_%d/bench", getpid());
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/log_bench_%d", getpid());
+    mkdir(dir, 0755);
+    Log::get_instance()->init(file, 0, 2000, 800000, mode.max_queue_size, mode.ring_size, mode.deferred);
+
+    long long start = now_ns(CLOCK_MONOTONIC);
+    pthread_t *tids = new pthread_t[threads];
+    long long *costs = new long long[threads];
+    for (int i = 0; i < threads; ++i)
+        pthread_create(tids + i, NULL, worker, costs + i);
+    long long sum = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        sum += costs[i];
+    }
+    result[0] = (double)sum / threads / g_lines;
+    result[1] = (double)threads * g_lines * 1e9 / (now_ns(CLOCK_MONOTONIC) - start);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 16;
+    g_lines = argc > 2 ? atoi(argv[2]) : 200000;
+    int per_request = argc > 3 ? atoi(argv[3]) : 16;
+
+    double *result = (double *)mmap(NULL, 2 * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    printf("threads=%d lines/thread=%d lines/request=%d\n", threads, g_lines, per_request);
+    printf("%-12s %12s %14s %14s\n", "mode", "cpu ns/line", "cpu ns/request", "lines/s");
+    for (size_t i = 0; i < sizeof(MODES) / sizeof(MODES[0]); ++i)
+    {
+        result[0] = result[1] = 0;
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            run_mode(MODES[i], threads, result);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        printf("%-12s %12.1f %14.1f %14.0f\n", MODES[i].name, result[0], result[0] * per_request, result[1]);
+
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), "rm -rf /tmp/log_bench_%d", pid);
+        system(cmd);
+    }
+    return 0;
+}
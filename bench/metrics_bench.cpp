@@ -0,0 +1,75 @@
+/*************************************************************
+*指标记录开销测试
+*多个线程同时计数和记录直方图，统计每次记录的平均耗时
+*用法: ./bench/metrics_bench [线程数] [每线程记录次数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "../metrics/metrics.h"
+
+static int g_events = 10000000;
+
+static long long now_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct result
+{
+    double count_ns;
+    double observe_ns;
+};
+
+static void *worker(void *arg)
+{
+    result *r = (result *)arg;
+    metrics *m = metrics::get_instance();
+    // 先注册本线程的分片，不计入测量
+    m->count(METRIC_ACCEPTS);
+
+    long long start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < g_events; ++i)
+        m->count_status(i & 1 ? 200 : 404);
+    long long mid = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    // 延迟分布在1us到1ms之间，覆盖多个指数区间
+    for (int i = 0; i < g_events; ++i)
+        m->observe(METRIC_REQUEST, 1000 + (i * 2654435761u) % 1000000);
+    long long end = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    r->count_ns = (double)(mid - start) / g_events;
+    r->observe_ns = (double)(end - mid) / g_events;
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    g_events = argc > 2 ? atoi(argv[2]) : 10000000;
+
+    pthread_t *tids = new pthread_t[threads];
+    result *results = new result[threads];
+    for (int i = 0; i < threads; ++i)
+        pthread_create(tids + i, NULL, worker, results + i);
+    double count_ns = 0, observe_ns = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        count_ns += results[i].count_ns;
+        observe_ns += results[i].observe_ns;
+    }
+
+    long long start = now_ns(CLOCK_MONOTONIC);
+    std::string text = metrics::get_instance()->render();
+    long long render = now_ns(CLOCK_MONOTONIC) - start;
+
+    printf("threads=%d events/thread=%d\n", threads, g_events);
+    printf("count_status   %6.1f ns/event\n", count_ns / threads);
+    printf("observe        %6.1f ns/event\n", observe_ns / threads);
+    printf("render         %6.1f us (%zu bytes)\n", render / 1000.0, text.size());
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*************************************************************
+*请求解析开销测试
+*不经过socket，把固定的请求报文直接放进连接的读缓冲区，分别测：
+*  split: parse_line逐行切分
+*  parse: 连接复用时的init()加process_read()，包含do_request里的stat/open/mmap
+*需要在项目根目录运行，do_request使用./root/resources下的页面
+*用法: ./bench/parser_bench [每种请求的次数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../http/http_conn.h"
+
+struct canned_request
+{
+    const char *name;
+    const char *text;
+};
+
+static const canned_request REQUESTS[] = {
+    {"get-minimal", "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"},
+    {"get-browser", "GET /picture.html HTTP/1.1\r\n"
+                    "Host: 127.0.0.1:9006\r\n"
+                    "Connection: keep-alive\r\n"
+                    "Cache-Control: max-age=0\r\n"
+                    "Upgrade-Insecure-Requests: 1\r\n"
+                    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+                    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                    "Referer: http://127.0.0.1:9006/\r\n"
+                    "Accept-Encoding: gzip, deflate, br\r\n"
+                    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                    "Cookie: session=0123456789abcdef\r\n"
+                    "\r\n"},
+    {"post-login", "POST /login HTTP/1.1\r\n"
+                   "Host: localhost\r\n"
+                   "Connection: keep-alive\r\n"
+                   "Content-Type: application/x-www-form-urlencoded\r\n"
+                   "Content-Length: 26\r\n"
+                   "\r\n"
+                   "user=alice&password=secret"},
+    {"not-found", "GET /nope.html HTTP/1.1\r\nHost: localhost\r\n\r\n"},
+};
+
+static const char *CODE_NAMES[] = {"NO_REQUEST", "GET_REQUEST", "BAD_REQUEST", "NO_RESOURCE", "FORBIDDEN_REQUEST",
+                                   "FILE_REQUEST", "INTERNAL_ERROR", "CLOSED_CONNECTION", "DYNAMIC_REQUEST"};
+
+// 静态对象，成员从零开始，m_file_address等不会是随机值
+static http_conn g_conn;
+
+// http_conn的友元，直接驱动私有的解析函数
+struct parser_bench
+{
+    static void setup(http_conn &conn, char *root)
+    {
+        conn.doc_root = root;
+        conn.m_TRIGMode = 0;
+        conn.m_close_log = 1;
+        conn.m_sockfd = -1;
+        conn.init();
+    }
+
+    // parse_line会把\r\n改成\0，每轮重新拷贝报文
+    static int split(http_conn &conn, const char *text, int len)
+    {
+        int lines = 0;
+        memcpy(conn.m_read_buf, text, len);
+        conn.m_read_idx = len;
+        conn.m_checked_idx = 0;
+        while (conn.parse_line() == http_conn::LINE_OK)
+            ++lines;
+        return lines;
+    }
+
+    static int parse(http_conn &conn, const char *text, int len)
+    {
+        conn.init();
+        memcpy(conn.m_read_buf, text, len);
+        conn.m_read_idx = len;
+        http_conn::HTTP_CODE ret = conn.process_read();
+        conn.unmap();
+        return ret;
+    }
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+
+    char cwd[200];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return 1;
+    char root[256];
+    snprintf(root, sizeof(root), "%s/root/resources", cwd);
+    if (access(root, R_OK) != 0)
+    {
+        fprintf(stderr, "%s not found, run from the project root\n", root);
+        return 1;
+    }
+    parser_bench::setup(g_conn, root);
+
+    printf("%-12s %6s %6s %-14s %12s %12s\n", "request", "bytes", "lines", "result", "split ns", "parse ns");
+    for (size_t r = 0; r < sizeof(REQUESTS) / sizeof(REQUESTS[0]); ++r)
+    {
+        const char *text = REQUESTS[r].text;
+        int len = strlen(text);
+
+        // 预热，同时拿到行数和解析结果
+        int lines = 0, ret = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            lines = parser_bench::split(g_conn, text, len);
+            ret = parser_bench::parse(g_conn, text, len);
+        }
+
+        long long start = now_ns();
+        for (int i = 0; i < rounds; ++i)
+            parser_bench::split(g_conn, text, len);
+        long long mid = now_ns();
+        for (int i = 0; i < rounds; ++i)
+            parser_bench::parse(g_conn, text, len);
+        long long end = now_ns();
+
+        printf("%-12s %6d %6d %-14s %12.1f %12.1f\n", REQUESTS[r].name, len, lines, CODE_NAMES[ret],
+               (double)(mid - start) / rounds, (double)(end - mid) / rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*************************************************************
+*阻塞队列生产者吞吐测试
+*多个生产者同时push，单个消费者pop，对比互斥锁+条件变量的旧实现
+*与无锁队列在忙等、让出CPU、futex休眠三种等待策略下的表现
+*用法: ./bench/queue_bench [生产者线程数] [每线程元素数] [队列长度]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "../lock/locker.h"
+#include "../log/block_queue.h"
+
+static int g_items = 1000000;
+
+// 原来的实现：循环数组 + 互斥锁 + 条件变量，满时直接失败
+template <class T>
+class mutex_queue
+{
+public:
+    mutex_queue(int max_size) : m_array(new T[max_size]), m_max_size(max_size), m_size(0), m_front(-1), m_back(-1) {}
+    ~mutex_queue() { delete[] m_array; }
+
+    bool push(const T &item)
+    {
+        m_mutex.lock();
+        if (m_size >= m_max_size)
+        {
+            m_cond.broadcast();
+            m_mutex.unlock();
+            return false;
+        }
+        m_back = (m_back + 1) % m_max_size;
+        m_array[m_back] = item;
+        m_size++;
+        m_cond.broadcast();
+        m_mutex.unlock();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        m_mutex.lock();
+        while (m_size <= 0)
+        {
+            if (!m_cond.wait(m_mutex.get()))
+            {
+                m_mutex.unlock();
+                return false;
+            }
+        }
+        m_front = (m_front + 1) % m_max_size;
+        item = m_array[m_front];
+        m_size--;
+        m_mutex.unlock();
+        return true;
+    }
+
+private:
+    locker m_mutex;
+    cond m_cond;
+    T *m_array;
+    int m_max_size;
+    int m_size;
+    int m_front;
+    int m_back;
+};
+
+// 每个元素大小接近一条短日志
+struct item
+{
+    long long seq;
+    char text[120];
+};
+
+template <class Q>
+struct bench_ctx
+{
+    Q *queue;
+    long long total;
+    long long retries;
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+template <class Q>
+static void *producer(void *arg)
+{
+    bench_ctx<Q> *ctx = (bench_ctx<Q> *)arg;
+    item it;
+    it.text[0] = '\0';
+    long long retries = 0;
+    for (int i = 0; i < g_items; ++i)
+    {
+        it.seq = i;
+        // 满时重试，保证每个元素都被消费，吞吐就是消费端真正处理的速度
+        while (!ctx->queue->push(it))
+        {
+            ++retries;
+            sched_yield();
+        }
+    }
+    __sync_fetch_and_add(&ctx->retries, retries);
+    return NULL;
+}
+
+template <class Q>
+static void *consumer(void *arg)
+{
+    bench_ctx<Q> *ctx = (bench_ctx<Q> *)arg;
+    item it;
+    for (long long i = 0; i < ctx->total; ++i)
+        ctx->queue->pop(it);
+    return NULL;
+}
+
+template <class Q>
+static void run(const char *name, Q *queue, int threads)
+{
+    bench_ctx<Q> ctx;
+    ctx.queue = queue;
+    ctx.total = (long long)threads * g_items;
+    ctx.retries = 0;
+
+    long long start = now_ns();
+    pthread_t cons;
+    pthread_create(&cons, NULL, consumer<Q>, &ctx);
+    pthread_t *tids = new pthread_t[threads];
+    for (int i = 0; i < threads; ++i)
+        pthread_create(tids + i, NULL, producer<Q>, &ctx);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    pthread_join(cons, NULL);
+    long long cost = now_ns() - start;
+    delete[] tids;
+
+    printf("%-12s %14.0f %12.1f %12lld\n", name, ctx.total * 1e9 / cost, (double)cost / ctx.total, ctx.retries);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 16;
+    g_items = argc > 2 ? atoi(argv[2]) : 1000000;
+    int size = argc > 3 ? atoi(argv[3]) : 1024;
+
+    printf("producers=%d items/producer=%d queue=%d\n", threads, g_items, size);
+    printf("%-12s %14s %12s %12s\n", "queue", "items/s", "ns/item", "full retries");
+
+    mutex_queue<item> *mq = new mutex_queue<item>(size);
+    run("mutex+cond", mq, threads);
+    delete mq;
+
+    const char *names[] = {"mpsc-spin", "mpsc-yield", "mpsc-futex"};
+    int waits[] = {QUEUE_WAIT_SPIN, QUEUE_WAIT_YIELD, QUEUE_WAIT_FUTEX};
+    for (int i = 0; i < 3; ++i)
+    {
+        block_queue<item> *q = new block_queue<item>(size, waits[i]);
+        run(names[i], q, threads);
+        delete q;
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*************************************************************
+*限速检查开销测试
+*来源IP分别有1k、100k、1M、10M个，每次检查随机取一个IP，对比两种令牌桶表的单次耗时：
+*  table: rate_limiter，固定大小的开放寻址表，一次检查一条缓存行
+*  map:   加互斥锁的unordered_map，IP越多越大，不淘汰
+*多线程时所有线程同时检查，各自取不同的IP
+*用法: ./bench/rate_limit_bench [线程数] [每线程检查次数] [桶组数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../http/rate_limit.h"
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 对照组：按需补充令牌的普通哈希表
+struct map_limiter
+{
+    struct bucket
+    {
+        uint32_t stamp;
+        float tokens;
+    };
+    std::unordered_map<uint32_t, bucket> buckets;
+    std::mutex lock;
+    float rate = 0.1f;
+    float burst = 100;
+
+    bool allow(uint32_t ip, uint32_t now)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::unordered_map<uint32_t, bucket>::iterator it = buckets.find(ip);
+        if (it == buckets.end())
+            it = buckets.emplace(ip, bucket{now, burst}).first;
+        bucket &b = it->second;
+        float tokens = b.tokens + (now - b.stamp) * rate;
+        if (tokens > burst)
+            tokens = burst;
+        b.stamp = now;
+        bool ok = tokens >= 1;
+        b.tokens = ok ? tokens - 1 : tokens;
+        return ok;
+    }
+};
+
+struct worker_arg
+{
+    int kind; // 0为table，1为map
+    int id;
+    int rounds;
+    uint32_t ips;
+    map_limiter *map;
+    long long ns;
+    long long allowed;
+};
+
+static void *run(void *p)
+{
+    worker_arg *a = (worker_arg *)p;
+    rate_limiter *table = rate_limiter::get_instance();
+    // xorshift加乘法取范围，生成一个IP只要几条指令
+    uint32_t x = 2463534242u + a->id * 7919;
+    long long allowed = 0;
+    int retry = 0;
+    long long start = now_ns();
+    for (int i = 0; i < a->rounds; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint32_t ip = 0x0a000000 + (uint32_t)(((uint64_t)x * a->ips) >> 32);
+        uint32_t now = rate_limiter::now_ms();
+        if (0 == a->kind)
+            allowed += table->allow(0, ip, now, retry);
+        else
+            allowed += a->map->allow(ip, now);
+    }
+    a->ns = now_ns() - start;
+    a->allowed = allowed;
+    return NULL;
+}
+
+static void measure(int kind, int threads, int rounds, uint32_t ips, map_limiter *map)
+{
+    std::vector<pthread_t> tids(threads);
+    std::vector<worker_arg> args(threads);
+    for (int t = 0; t < threads; ++t)
+    {
+        args[t] = worker_arg{kind, t, rounds, ips, map, 0, 0};
+        pthread_create(&tids[t], NULL, run, &args[t]);
+    }
+    long long ns = 0, allowed = 0;
+    for (int t = 0; t < threads; ++t)
+    {
+        pthread_join(tids[t], NULL);
+        ns += args[t].ns;
+        allowed += args[t].allowed;
+    }
+    printf(" %10.1f %7.1f%%", (double)ns / threads / rounds, 100.0 * allowed / threads / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000000;
+    size_t groups = argc > 3 ? atol(argv[3]) : rate_limiter::DEFAULT_GROUPS;
+
+    // 每秒100个令牌、容量100，两种表的放行比例应当一致：
+    // IP少时每个IP被检查得很频繁，大部分被拒绝；IP多时几乎都放行
+    rate_limiter *table = rate_limiter::get_instance();
+    table->add(1, "/", 100, 100, true);
+    table->build(groups);
+    printf("threads %d, slots %zu (%zu KB)\n", threads, table->slots(), table->slots() * 16 / 1024);
+    printf("%-10s %10s %8s %10s %8s\n", "ips", "table ns", "allowed", "map ns", "allowed");
+
+    static const uint32_t IPS[] = {1000, 100000, 1000000, 10000000};
+    for (uint32_t ips : IPS)
+    {
+        printf("%-10u", ips);
+        measure(0, threads, rounds, ips, NULL);
+        map_limiter map;
+        map.buckets.reserve(ips < 4000000 ? ips : 4000000);
+        measure(1, threads, rounds, ips, &map);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*************************************************************
+*路由查找开销测试
+*路由表有1000条路由（精确路由和前缀挂载混合），对比三种查找方式的单次耗时：
+*  trie:   router，基数树，不分配内存
+*  linear: 按顺序逐条比较，原来DEFAULT_HTML和数字前缀判断的做法
+*  hash:   unordered_map<string>，只能做精确匹配，每次查找构造一个string
+*查询分三类：命中精确路由、命中挂载目录下的文件、不匹配任何路由
+*用法: ./bench/router_bench [路由数] [每类查询的次数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../http/router.h"
+
+static const int GET = 1;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 逐条比较，精确路由直接返回，挂载取最长的
+static const route *linear_match(const std::vector<route> &routes, const char *path, size_t len)
+{
+    const route *best = NULL;
+    size_t best_len = 0;
+    for (const route &r : routes)
+    {
+        size_t n = strlen(r.path);
+        if (!r.prefix && n == len && memcmp(r.path, path, len) == 0)
+            return &r;
+        if (r.prefix && n <= len && n > best_len && memcmp(r.path, path, n) == 0)
+        {
+            best = &r;
+            best_len = n;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    // 九成是API风格的精确路由，一成是静态资源目录的挂载
+    std::vector<std::string> paths;
+    std::vector<route> table;
+    static const char *ACTIONS[] = {"list", "get", "create", "update", "delete"};
+    int mounts = count / 10;
+    for (int i = 0; i < count; ++i)
+    {
+        char buf[128];
+        if (i < mounts)
+            snprintf(buf, sizeof(buf), "/static/app%03d/", i);
+        else
+            snprintf(buf, sizeof(buf), "/api/v%d/resource%03d/%s", 1 + i % 3, i / 5, ACTIONS[i % 5]);
+        paths.push_back(buf);
+    }
+    table.reserve(count);
+    for (int i = 0; i < count; ++i)
+        table.push_back(route{paths[i].c_str(), GET, i < mounts, NULL, i});
+
+    long long start = now_ns();
+    router trie;
+    for (const route &r : table)
+        trie.add(r);
+    trie.build();
+    long long build_ns = now_ns() - start;
+
+    std::unordered_map<std::string, const route *> hash;
+    for (const route &r : table)
+        if (!r.prefix)
+            hash[r.path] = &r;
+
+    // 三类查询，各取256条轮流使用
+    std::mt19937 rng(42);
+    std::vector<std::string> queries[3];
+    static const char *NAMES[] = {"exact", "mount", "miss"};
+    for (int i = 0; i < 256; ++i)
+    {
+        queries[0].push_back(paths[mounts + rng() % (count - mounts)]);
+        queries[1].push_back(paths[rng() % mounts] + "js/vendor/jquery.min.js");
+        char buf[128];
+        snprintf(buf, sizeof(buf), "/api/v%d/resource%03d/unknown", 1 + (int)(rng() % 3), (int)(rng() % 200));
+        queries[2].push_back(buf);
+    }
+
+    // 三种方式的结果必须一致
+    for (int k = 0; k < 3; ++k)
+    {
+        for (const std::string &q : queries[k])
+        {
+            size_t matched = 0;
+            const route *a = trie.match(0, q.c_str(), q.size(), matched);
+            const route *b = linear_match(table, q.c_str(), q.size());
+            // router保存的是路由的副本，按编号比较
+            if ((a ? a->handler : -1) != (b ? b->handler : -1))
+            {
+                fprintf(stderr, "mismatch on %s\n", q.c_str());
+                return 1;
+            }
+        }
+    }
+
+    printf("routes %d, trie nodes %zu, build %.2f ms\n", count, trie.nodes(), build_ns / 1e6);
+    printf("%-8s %12s %12s %12s\n", "query", "trie ns", "linear ns", "hash ns");
+    volatile long long sink = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        const std::vector<std::string> &qs = queries[k];
+        long long t0 = now_ns();
+        for (int i = 0; i < rounds; ++i)
+        {
+            const std::string &q = qs[i & 255];
+            size_t matched = 0;
+            const route *r = trie.match(0, q.c_str(), q.size(), matched);
+            sink = sink + (r ? r->handler : -1);
+        }
+        long long t1 = now_ns();
+        // 线性扫描慢得多，次数减少到百分之一
+        int linear_rounds = rounds / 100 > 0 ? rounds / 100 : 1;
+        for (int i = 0; i < linear_rounds; ++i)
+        {
+            const std::string &q = qs[i & 255];
+            const route *r = linear_match(table, q.c_str(), q.size());
+            sink = sink + (r ? r->handler : -1);
+        }
+        long long t2 = now_ns();
+        for (int i = 0; i < rounds; ++i)
+        {
+            const std::string &q = qs[i & 255];
+            // 服务器里路径是读缓冲区中的char*，查哈希表要先构造string
+            std::unordered_map<std::string, const route *>::const_iterator it = hash.find(std::string(q.c_str(), q.size()));
+            sink = sink + (it != hash.end() ? it->second->handler : -1);
+        }
+        long long t3 = now_ns();
+        printf("%-8s %12.1f %12.1f %12.1f\n", NAMES[k], (double)(t1 - t0) / rounds, (double)(t2 - t1) / linear_rounds,
+               (double)(t3 - t2) / rounds);
+    }
+    return 0;
+}
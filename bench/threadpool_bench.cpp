@@ -0,0 +1,103 @@
+/*************************************************************
+*线程池交接延迟测试
+*从主线程append到工作线程开始处理(process)的时间：
+*  idle:  每次只投递一个任务，等它处理完再投下一个，测工作线程的唤醒延迟
+*  burst: 一次投递一批任务，测排队加唤醒的延迟
+*任务不做任何工作，不需要MySQL
+*用法: ./bench/threadpool_bench [线程数] [任务数] [每批任务数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "../threadpool/threadpool.h"
+
+// 满足threadpool<T>对任务类型的要求
+struct bench_task
+{
+    int m_state;
+    int improv;
+    int timer_flag;
+    request_trace m_trace;
+    int64_t m_queued_ns;
+    bool m_shed;
+
+    int64_t enqueued_ns;
+    int64_t latency_ns;
+    std::atomic<int> done;
+
+    bool read_once() { return true; }
+    bool write() { return true; }
+    bool pipelined() const { return false; }
+    void process()
+    {
+        latency_ns = metrics::now_ns() - enqueued_ns;
+        done.store(1, std::memory_order_release);
+    }
+};
+
+static void wait_done(bench_task &task)
+{
+    // 单核时忙等会占住工作线程要用的CPU
+    while (!task.done.load(std::memory_order_acquire))
+        sched_yield();
+}
+
+static void report(const char *name, std::vector<int64_t> &lat)
+{
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += lat[i];
+    printf("%-6s %10zu %10.1f %10.1f %10.1f %10.1f\n", name, n, sum / n / 1000.0, lat[n / 2] / 1000.0,
+           lat[n * 99 / 100] / 1000.0, lat[n * 999 / 1000] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int tasks = argc > 2 ? atoi(argv[2]) : 100000;
+    int batch = argc > 3 ? atoi(argv[3]) : 64;
+
+    threadpool<bench_task> pool(0, threads);
+    std::vector<bench_task> slots(batch);
+    for (int i = 0; i < batch; ++i)
+        slots[i].m_trace.reset();
+
+    std::vector<int64_t> lat;
+    lat.reserve(tasks);
+    bench_task &one = slots[0];
+    for (int i = 0; i < tasks; ++i)
+    {
+        one.done.store(0, std::memory_order_relaxed);
+        one.enqueued_ns = metrics::now_ns();
+        pool.append(&one, 0);
+        wait_done(one);
+        lat.push_back(one.latency_ns);
+    }
+    printf("%-6s %10s %10s %10s %10s %10s\n", "mode", "tasks", "mean us", "p50 us", "p99 us", "p999 us");
+    report("idle", lat);
+
+    lat.clear();
+    for (int sent = 0; sent < tasks; sent += batch)
+    {
+        int n = std::min(batch, tasks - sent);
+        for (int i = 0; i < n; ++i)
+        {
+            slots[i].done.store(0, std::memory_order_relaxed);
+            slots[i].enqueued_ns = metrics::now_ns();
+            pool.append(&slots[i], 0);
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            wait_done(slots[i]);
+            lat.push_back(slots[i].latency_ns);
+        }
+    }
+    report("burst", lat);
+    return 0;
+}
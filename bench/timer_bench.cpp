@@ -0,0 +1,109 @@
+/*************************************************************
+*定时器链表开销测试
+*链表中已有N个定时器时，测量三种操作的单次耗时：
+*  add:    新连接加一个最晚到期的定时器
+*  adjust: 连接上有数据，把定时器延后到最晚
+*  tick:   到期处理，按每个到期定时器折算
+*定时器按随机顺序分配，链表顺序与内存顺序无关，接近服务器运行一段时间后的情况
+*用法: ./bench/timer_bench [每种操作的次数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "../timer/lst_timer.h"
+
+static const int SIZES[] = {1000, 10000, 100000};
+
+static void noop_cb(client_data *)
+{
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static util_timer *new_timer(time_t expire)
+{
+    util_timer *timer = new util_timer;
+    timer->expire = expire;
+    timer->cb_func = noop_cb;
+    timer->user_data = NULL;
+    return timer;
+}
+
+static bool later(const util_timer *a, const util_timer *b)
+{
+    return a->expire > b->expire;
+}
+
+static void run(int n, int ops)
+{
+    // 大链表上每次操作都要走很远，按规模减少次数
+    if ((long long)ops * n > 10000LL * 1000)
+        ops = std::max(10LL, 10000LL * 1000 / n);
+    sort_timer_lst lst;
+    // 远未到期，tick不会处理这些定时器
+    time_t base = time(NULL) + 3600;
+
+    // 到期时间随机打乱后按从晚到早插入，每次都插在表头，建表是O(N)
+    std::vector<util_timer *> timers(n);
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(n));
+    for (int i = 0; i < n; ++i)
+        timers[i] = new_timer(base + order[i]);
+    std::vector<util_timer *> sorted(timers);
+    std::sort(sorted.begin(), sorted.end(), later);
+    for (int i = 0; i < n; ++i)
+        lst.add_timer(sorted[i]);
+    time_t latest = base + n;
+
+    // add
+    std::vector<util_timer *> added(ops);
+    for (int i = 0; i < ops; ++i)
+        added[i] = new_timer(latest++);
+    long long start = now_ns();
+    for (int i = 0; i < ops; ++i)
+        lst.add_timer(added[i]);
+    double add_ns = (double)(now_ns() - start) / ops;
+    for (int i = 0; i < ops; ++i)
+        lst.del_timer(added[i]);
+
+    // adjust，随机挑一个定时器延后
+    start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        util_timer *timer = timers[rand() % n];
+        timer->expire = latest++;
+        lst.adjust_timer(timer);
+    }
+    double adjust_ns = (double)(now_ns() - start) / ops;
+
+    // tick，已经到期的定时器都在表头
+    for (int i = 0; i < ops; ++i)
+        lst.add_timer(new_timer(0));
+    start = now_ns();
+    lst.tick();
+    double tick_ns = (double)(now_ns() - start) / ops;
+
+    printf("%8d %12.1f %12.1f %12.1f\n", n, add_ns, adjust_ns, tick_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 1000;
+    srand(1);
+
+    printf("%8s %12s %12s %12s\n", "timers", "add ns", "adjust ns", "tick ns");
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); ++i)
+        run(SIZES[i], ops);
+    return 0;
+}
@@ -4,7 +4,7 @@ Config::Config(){
     //端口号,默认9006
     PORT = 9006;
 
-    //日志写入方式，默认同步
+    //日志写入方式，默认同步，1为阻塞队列异步，2为每线程环形缓冲区异步，3为环形缓冲区+延迟格式化
     LOGWrite = 0;
 
     //触发组合模式,默认listenfd LT + connfd LT
@@ -30,11 +30,61 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //最小日志级别，默认DEBUG
+    log_level = 0;
+
+    //日志刷盘策略，默认按时间间隔
+    log_flush = 0;
+
+    //异步日志队列等待策略，默认futex休眠
+    queue_wait = 2;
+
+    //二进制访问日志，默认关闭
+    access_log = 0;
+
+    //慢请求追踪，默认关闭
+    trace_threshold = 0;
+
+    //凭据存储，0为MySQL，1为本地mmap哈希文件，2为不提供登录注册
+    //编译时没有MySQL则默认不提供登录注册
+#ifdef WITH_MYSQL
+    credential = 0;
+#else
+    credential = 2;
+#endif
+
+    //每次epoll唤醒最多accept 64个连接，避免连接风暴时饿死已有连接的读写
+    accept_budget = 64;
+
+    //listen的backlog，实际值受net.core.somaxconn限制
+    backlog = 1024;
+
+    //TCP调优配置，默认0保持系统默认的socket选项
+    tcp_profile = 0;
+
+    //压缩响应体缓存32MB，0表示只用预压缩文件、不做即时压缩
+    compress_cache = 32;
+
+    //目录列表，默认关闭，请求目录时回404
+    autoindex = 0;
+
+    //1MB及以上的文件按窗口读取发送，0表示总是整体mmap
+    large_file = 1024;
+
+    //按排队时间拒绝请求，默认关闭
+    queue_target = 0;
+
+    //数据库请求不限，默认只受连接池大小约束
+    db_limit = 0;
+
+    //限速规则，默认不限速
+    rate_limit = "";
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:v:f:q:b:T:d:A:B:P:z:i:L:Q:D:R:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +129,81 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'v':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            log_flush = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            queue_wait = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            access_log = atoi(optarg);
+            break;
+        }
+        case 'T':
+        {
+            trace_threshold = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            credential = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            accept_budget = atoi(optarg);
+            break;
+        }
+        case 'B':
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case 'P':
+        {
+            tcp_profile = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            compress_cache = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            autoindex = atoi(optarg);
+            break;
+        }
+        case 'L':
+        {
+            large_file = atoi(optarg);
+            break;
+        }
+        case 'Q':
+        {
+            queue_target = atoi(optarg);
+            break;
+        }
+        case 'D':
+        {
+            db_limit = atoi(optarg);
+            break;
+        }
+        case 'R':
+        {
+            rate_limit = optarg;
+            break;
+        }
         default:
             break;
         }
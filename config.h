@@ -42,6 +42,51 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //最小日志级别
+    int log_level;
+
+    //日志刷盘策略
+    int log_flush;
+
+    //异步日志队列为空时写日志线程的等待策略
+    int queue_wait;
+
+    //是否开启二进制访问日志
+    int access_log;
+
+    //慢请求追踪阈值，单位微秒，0表示关闭
+    int trace_threshold;
+
+    //凭据存储后端
+    int credential;
+
+    //每次epoll唤醒最多accept的连接数
+    int accept_budget;
+
+    //listen的backlog
+    int backlog;
+
+    //TCP调优配置
+    int tcp_profile;
+
+    //压缩响应体缓存的大小，单位MB
+    int compress_cache;
+
+    //目录请求是否生成目录列表
+    int autoindex;
+
+    //不小于这个大小的文件按窗口读取发送，单位KB
+    int large_file;
+
+    //准入控制的排队时间目标，单位毫秒，0表示关闭
+    int queue_target;
+
+    //同时进行的数据库请求上限，0表示不限
+    int db_limit;
+
+    //按来源IP限速的规则，空表示不限速
+    string rate_limit;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compress_cache.h"
+#include "../metrics/metrics.h"
+
+// 小于一个报文的文件压缩省不了往返，只多花CPU
+static const off_t MIN_COMPRESS_SIZE = 256;
+// gzip用zlib默认级别；br只在第一次请求时压缩一次，质量取高一些
+static const int GZIP_LEVEL = 6;
+static const int BROTLI_QUALITY = 9;
+
+compress_cache::compress_cache()
+{
+    m_bytes = 0;
+    m_max_bytes = 0;
+}
+
+void compress_cache::init(size_t max_bytes)
+{
+    m_max_bytes = max_bytes;
+}
+
+int compress_cache::supported()
+{
+    int enc = ENC_IDENTITY;
+#ifdef WITH_ZLIB
+    enc |= ENC_GZIP;
+#endif
+#ifdef WITH_BROTLI
+    enc |= ENC_BR;
+#endif
+    return enc;
+}
+
+const char *compress_cache::name(int enc)
+{
+    if (ENC_BR == enc)
+        return "br";
+    if (ENC_GZIP == enc)
+        return "gzip";
+    return "identity";
+}
+
+const char *compress_cache::suffix(int enc)
+{
+    return ENC_BR == enc ? ".br" : ".gz";
+}
+
+bool compress_cache::compressible(const char *type)
+{
+    return strncmp(type, "text/", 5) == 0 || strstr(type, "javascript") || strstr(type, "xml") ||
+           strstr(type, "json");
+}
+
+// Accept-Encoding: gzip, deflate, br;q=0.8
+int compress_cache::parse_accept(const char *value)
+{
+    int enc = ENC_IDENTITY;
+    const char *p = value;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        size_t len = strcspn(p, " \t;,");
+        if (0 == len)
+            break;
+        int token = ENC_IDENTITY;
+        if (4 == len && strncasecmp(p, "gzip", 4) == 0)
+            token = ENC_GZIP;
+        else if (2 == len && strncasecmp(p, "br", 2) == 0)
+            token = ENC_BR;
+        else if (1 == len && '*' == *p)
+            token = ENC_GZIP | ENC_BR;
+        p += len;
+        // 只关心q是否为0，其余权重不影响选择，两种都接受时总是优先br
+        bool refused = false;
+        const char *end = p + strcspn(p, ",");
+        const char *q = strchr(p, ';');
+        if (q && q < end)
+        {
+            q += 1 + strspn(q + 1, " \t");
+            if ((*q == 'q' || *q == 'Q') && q[1] == '=')
+                refused = atof(q + 2) <= 0;
+        }
+        if (!refused)
+            enc |= token;
+        p = end;
+    }
+    return enc;
+}
+
+bool compress_cache::deflate_file(const std::string &src, int enc, std::string &out)
+{
+#ifdef WITH_BROTLI
+    if (ENC_BR == enc)
+    {
+        size_t len = BrotliEncoderMaxCompressedSize(src.size());
+        out.resize(len);
+        if (!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, src.size(),
+                                   (const uint8_t *)src.data(), &len, (uint8_t *)&out[0]))
+            return false;
+        out.resize(len);
+        return true;
+    }
+#endif
+#ifdef WITH_ZLIB
+    if (ENC_GZIP == enc)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits加16输出gzip格式，而不是裸的zlib流
+        if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        out.resize(deflateBound(&zs, src.size()) + 18);
+        zs.next_in = (Bytef *)src.data();
+        zs.avail_in = src.size();
+        zs.next_out = (Bytef *)&out[0];
+        zs.avail_out = out.size();
+        int ret = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return Z_STREAM_END == ret;
+    }
+#endif
+    return false;
+}
+
+std::shared_ptr<const std::string> compress_cache::get(const char *path, const struct stat &st, int enc)
+{
+    std::shared_ptr<const std::string> data;
+    // 超过缓存上限四分之一的文件不缓存，免得一个大文件把其余条目全挤出去
+    if (!(supported() & enc) || st.st_size < MIN_COMPRESS_SIZE || (size_t)st.st_size > m_max_bytes / 4)
+        return data;
+
+    std::string key(path);
+    key += ENC_BR == enc ? ":br" : ":gz";
+    m_lock.lock();
+    std::unordered_map<std::string, entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        entry &e = it->second;
+        if (e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+            e.size == st.st_size && e.ino == st.st_ino)
+        {
+            m_lru.splice(m_lru.begin(), m_lru, e.lru);
+            data = e.data;
+            m_lock.unlock();
+            if (data)
+                metrics::get_instance()->count(METRIC_COMPRESS_HIT);
+            return data;
+        }
+        // 文件改过，丢掉旧的结果
+        if (e.data)
+            m_bytes -= e.data->size();
+        m_lru.erase(e.lru);
+        m_entries.erase(it);
+    }
+    m_lock.unlock();
+
+    // 压缩在锁外进行，同一文件并发未命中时可能重复压缩，结果相同，后放入的覆盖先放入的
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return data;
+    std::string src;
+    src.resize(st.st_size);
+    ssize_t n = pread(fd, &src[0], src.size(), 0);
+    close(fd);
+    if (n != st.st_size)
+        return data;
+    std::string *out = new std::string;
+    if (deflate_file(src, enc, *out) && out->size() < src.size())
+        data.reset(out);
+    else
+        delete out;
+    metrics::get_instance()->count(METRIC_COMPRESS_MISS);
+
+    m_lock.lock();
+    it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        if (it->second.data)
+            m_bytes -= it->second.data->size();
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+    entry &e = m_entries[key];
+    e.mtime = st.st_mtim;
+    e.size = st.st_size;
+    e.ino = st.st_ino;
+    e.data = data;
+    m_lru.push_front(key);
+    e.lru = m_lru.begin();
+    if (data)
+        m_bytes += data->size();
+    // 正在发送的旧条目由连接持有的shared_ptr保活，淘汰只是从缓存中摘掉
+    while (m_bytes > m_max_bytes && m_lru.size() > 1)
+    {
+        std::unordered_map<std::string, entry>::iterator victim = m_entries.find(m_lru.back());
+        if (victim->second.data)
+            m_bytes -= victim->second.data->size();
+        m_entries.erase(victim);
+        m_lru.pop_back();
+    }
+    m_lock.unlock();
+    return data;
+}
@@ -0,0 +1,78 @@
+/*************************************************************
+*压缩响应体缓存
+*按Accept-Encoding协商gzip/br，静态文件优先使用同目录下预压缩的
+*.br/.gz文件，没有时在第一次请求时压缩一次，以路径+编码为键缓存，
+*文件的mtime、大小或inode变化后重新压缩，总字节数超过上限时按LRU淘汰
+**************************************************************/
+
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <sys/stat.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+// 内容编码，Accept-Encoding解析成按位或的掩码
+enum CONTENT_ENCODING
+{
+    ENC_IDENTITY = 0,
+    ENC_GZIP = 1,
+    ENC_BR = 2,
+};
+
+class compress_cache
+{
+public:
+    static compress_cache *get_instance()
+    {
+        static compress_cache instance;
+        return &instance;
+    }
+
+    // max_bytes为缓存的压缩结果总字节数上限，0表示不做即时压缩，只用预压缩文件
+    void init(size_t max_bytes);
+    bool enabled() const { return m_max_bytes > 0; }
+
+    // 取path按enc压缩后的内容，st是调用者刚stat到的文件状态；
+    // 不支持该编码、文件太小或太大、压缩后不更小时返回空指针，发送原文件
+    std::shared_ptr<const std::string> get(const char *path, const struct stat &st, int enc);
+
+    // 解析Accept-Encoding的值，q=0的编码不算接受
+    static int parse_accept(const char *value);
+    // 编译进来的即时压缩编码
+    static int supported();
+    // Content-Encoding头和预压缩文件后缀用的名字
+    static const char *name(int enc);
+    static const char *suffix(int enc);
+    // 文本类的响应体类型才值得压缩，图片和音视频本身已经压缩过
+    static bool compressible(const char *type);
+
+private:
+    compress_cache();
+    ~compress_cache() {}
+
+    // 压缩失败或不支持时返回false
+    static bool deflate_file(const std::string &src, int enc, std::string &out);
+
+    struct entry
+    {
+        struct timespec mtime;
+        off_t size;
+        ino_t ino;
+        // 为空表示压缩后不更小，记下来避免每次都重新压缩
+        std::shared_ptr<const std::string> data;
+        std::list<std::string>::iterator lru;
+    };
+
+    locker m_lock;
+    std::unordered_map<std::string, entry> m_entries;
+    // 最近使用的在前
+    std::list<std::string> m_lru;
+    size_t m_bytes;
+    size_t m_max_bytes;
+};
+
+#endif
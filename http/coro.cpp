@@ -0,0 +1,220 @@
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "coro.h"
+
+static int64_t mono_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+coro_awaiter coro_sleep(int ms)
+{
+    return coro_awaiter{CORO_SLEEP, mono_ns() + (int64_t)(ms > 0 ? ms : 0) * 1000000, nullptr, nullptr};
+}
+
+coro_awaiter coro_blocking(std::function<void()> fn)
+{
+    return coro_awaiter{CORO_BLOCKING, 0, std::move(fn), nullptr};
+}
+
+coro_awaiter coro_flush()
+{
+    return coro_awaiter{CORO_FLUSH, 0, nullptr, nullptr};
+}
+
+coro_scheduler::coro_scheduler() : m_wake_fd(-1), m_pending(false)
+{
+}
+
+coro_scheduler::~coro_scheduler()
+{
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+}
+
+bool coro_scheduler::init(int threads, int max_fd)
+{
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0)
+        return false;
+    m_parked.assign(max_fd, NULL);
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0)
+            return false;
+        pthread_detach(tid);
+    }
+    return true;
+}
+
+void coro_scheduler::wake()
+{
+    // 主线程取走之前只通知一次
+    if (!m_pending.exchange(true))
+    {
+        uint64_t one = 1;
+        ssize_t n = write(m_wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void coro_scheduler::woken()
+{
+    uint64_t n;
+    ssize_t r = read(m_wake_fd, &n, sizeof(n));
+    (void)r;
+}
+
+void coro_scheduler::park(coro_task &task)
+{
+    m_lock.lock();
+    m_incoming.push_back(&task.promise());
+    m_lock.unlock();
+    wake();
+}
+
+void coro_scheduler::ready(http_conn *conn)
+{
+    m_lock.lock();
+    m_flushed.push_back(conn);
+    m_lock.unlock();
+    wake();
+}
+
+void coro_scheduler::cancel(coro_task::promise_type *p)
+{
+    // 连接已经不在了，协程帧归调度器，等它等的事件到达后销毁
+    p->cancelled = true;
+    p->conn = NULL;
+    p->owner->release();
+    p->owner = NULL;
+}
+
+void coro_scheduler::closed(int fd)
+{
+    if (fd < 0 || fd >= (int)m_parked.size())
+        return;
+    m_lock.lock();
+    if (m_parked[fd])
+    {
+        cancel(m_parked[fd]);
+        m_parked[fd] = NULL;
+    }
+    // 刚挂起、主线程还没取走的
+    for (coro_task::promise_type *p : m_incoming)
+        if (p->fd == fd && !p->cancelled)
+            cancel(p);
+    m_lock.unlock();
+}
+
+void coro_scheduler::fire(coro_task::promise_type *p, std::vector<http_conn *> &out)
+{
+    m_lock.lock();
+    bool cancelled = p->cancelled;
+    if (!cancelled && m_parked[p->fd] == p)
+        m_parked[p->fd] = NULL;
+    m_lock.unlock();
+    if (cancelled)
+    {
+        coro_task::handle::from_promise(*p).destroy();
+        return;
+    }
+    out.push_back(p->conn);
+}
+
+void coro_scheduler::poll(std::vector<http_conn *> &out)
+{
+    if (m_pending.exchange(false))
+    {
+        m_lock.lock();
+        m_take_incoming.swap(m_incoming);
+        m_take_done.swap(m_done);
+        m_take_flushed.swap(m_flushed);
+        for (coro_task::promise_type *p : m_take_incoming)
+            if (!p->cancelled)
+                m_parked[p->fd] = p;
+        m_lock.unlock();
+
+        for (coro_task::promise_type *p : m_take_incoming)
+        {
+            // 还没开始等就已经取消的直接销毁
+            if (p->cancelled)
+                fire(p, out);
+            else if (CORO_SLEEP == p->wait)
+                m_timers.push(timer_entry(p->deadline, p));
+            else
+            {
+                m_job_lock.lock();
+                m_jobs.push(p);
+                m_job_lock.unlock();
+                m_job_stat.post();
+            }
+        }
+        for (coro_task::promise_type *p : m_take_done)
+            fire(p, out);
+        out.insert(out.end(), m_take_flushed.begin(), m_take_flushed.end());
+        m_take_incoming.clear();
+        m_take_done.clear();
+        m_take_flushed.clear();
+    }
+    if (m_timers.empty())
+        return;
+    int64_t now = mono_ns();
+    while (!m_timers.empty() && m_timers.top().first <= now)
+    {
+        coro_task::promise_type *p = m_timers.top().second;
+        m_timers.pop();
+        fire(p, out);
+    }
+}
+
+int coro_scheduler::timeout(int limit) const
+{
+    if (m_timers.empty())
+        return limit;
+    int64_t wait = (m_timers.top().first - mono_ns() + 999999) / 1000000;
+    if (wait < 0)
+        return 0;
+    return wait < limit ? (int)wait : limit;
+}
+
+void *coro_scheduler::worker(void *arg)
+{
+    coro_scheduler *s = (coro_scheduler *)arg;
+    s->run();
+    return s;
+}
+
+void coro_scheduler::run()
+{
+    while (true)
+    {
+        m_job_stat.wait();
+        m_job_lock.lock();
+        if (m_jobs.empty())
+        {
+            m_job_lock.unlock();
+            continue;
+        }
+        coro_task::promise_type *p = m_jobs.front();
+        m_jobs.pop();
+        m_job_lock.unlock();
+        // 协程挂起着，promise只有这个线程访问
+        try
+        {
+            p->job();
+        }
+        catch (...)
+        {
+            p->job_error = std::current_exception();
+        }
+        m_lock.lock();
+        m_done.push_back(p);
+        m_lock.unlock();
+        wake();
+    }
+}
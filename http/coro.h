@@ -0,0 +1,215 @@
+/*************************************************************
+*协程处理函数
+*动态接口可以写成C++20协程，在等待时挂起，不占用工作线程：
+*  co_await coro_sleep(ms):     由主线程的事件循环计时
+*  co_await coro_blocking(fn):  fn在单独的阻塞线程里执行，用于数据库查询等阻塞调用
+*  co_await coro_flush():       把响应体里已有的内容作为一个chunk发出去，写完再继续
+*定时器到期、阻塞任务完成后，主线程把连接交回线程池，从挂起的地方接着执行。
+*挂起期间连接不注册任何事件，连接超时被关闭时协程不再继续，等它等的事件到达后销毁。
+*只能在处理函数本身里co_await，协程之间不嵌套
+**************************************************************/
+
+#ifndef HTTP_CORO_H
+#define HTTP_CORO_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "../lock/locker.h"
+
+class http_conn;
+
+// 协程挂起时等的事件
+enum CORO_WAIT
+{
+    CORO_NONE = 0,
+    CORO_SLEEP,
+    CORO_BLOCKING,
+    CORO_FLUSH
+};
+
+// 协程处理函数的返回类型，协程帧由它独占
+class coro_task
+{
+public:
+    struct promise_type
+    {
+        coro_task get_return_object() { return coro_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        // 创建后先挂起，由http_conn开始执行
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // 结束后保持挂起，http_conn取走异常后销毁
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+
+        // 处理函数抛出的异常
+        std::exception_ptr error;
+        // 挂起时等的事件和它的参数
+        int wait = CORO_NONE;
+        int64_t deadline = 0;
+        std::function<void()> job;
+        // 阻塞任务抛出的异常，在co_await处重新抛出
+        std::exception_ptr job_error;
+        // 以下由调度器使用
+        http_conn *conn = NULL;
+        int fd = -1;
+        coro_task *owner = NULL;
+        bool cancelled = false;
+    };
+    typedef std::coroutine_handle<promise_type> handle;
+
+    coro_task() {}
+    explicit coro_task(handle h) : m_handle(h) { m_handle.promise().owner = this; }
+    coro_task(coro_task &&o) noexcept : m_handle(o.m_handle)
+    {
+        o.m_handle = nullptr;
+        if (m_handle)
+            m_handle.promise().owner = this;
+    }
+    coro_task &operator=(coro_task &&o) noexcept
+    {
+        if (this != &o)
+        {
+            reset();
+            m_handle = o.m_handle;
+            o.m_handle = nullptr;
+            if (m_handle)
+                m_handle.promise().owner = this;
+        }
+        return *this;
+    }
+    coro_task(const coro_task &) = delete;
+    coro_task &operator=(const coro_task &) = delete;
+    ~coro_task() { reset(); }
+
+    explicit operator bool() const { return (bool)m_handle; }
+    promise_type &promise() { return m_handle.promise(); }
+    bool done() const { return m_handle.done(); }
+    void resume() { m_handle.resume(); }
+    void reset()
+    {
+        if (m_handle)
+            m_handle.destroy();
+        m_handle = nullptr;
+    }
+    // 连接关闭时把协程帧交给调度器，之后由调度器销毁
+    handle release()
+    {
+        handle h = m_handle;
+        m_handle = nullptr;
+        return h;
+    }
+
+private:
+    handle m_handle;
+};
+
+// 记下要等的事件后挂起，由http_conn在工作线程退出处理函数后交给调度器
+struct coro_awaiter
+{
+    int wait;
+    int64_t deadline;
+    std::function<void()> job;
+    coro_task::handle h;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coro_task::handle hd)
+    {
+        h = hd;
+        coro_task::promise_type &p = h.promise();
+        p.wait = wait;
+        p.deadline = deadline;
+        p.job = std::move(job);
+    }
+    void await_resume()
+    {
+        coro_task::promise_type &p = h.promise();
+        p.job = nullptr;
+        if (p.job_error)
+        {
+            std::exception_ptr e = p.job_error;
+            p.job_error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+};
+
+// 挂起ms毫秒
+coro_awaiter coro_sleep(int ms);
+// fn在阻塞线程里执行，它抛出的异常在co_await处重新抛出。
+// 连接可能在fn执行期间超时关闭，fn只应读写协程自己的局部变量，要用的请求内容先复制出来
+coro_awaiter coro_blocking(std::function<void()> fn);
+// 第一次调用时发出状态行和响应头，之后响应体改用分块编码，已经写进响应体的内容作为一个chunk发出
+coro_awaiter coro_flush();
+
+class coro_scheduler
+{
+public:
+    static coro_scheduler *get_instance()
+    {
+        static coro_scheduler instance;
+        return &instance;
+    }
+
+    // threads是执行阻塞任务的线程数，max_fd是连接fd的上限
+    bool init(int threads, int max_fd);
+    // 主线程监听这个eventfd，可读时调用woken，之后调用poll
+    int wake_fd() const { return m_wake_fd; }
+    void woken();
+
+    // 工作线程调用：连接上的协程挂起等待定时器或阻塞任务，调用之后不能再访问这个连接
+    void park(coro_task &task);
+    // 任意线程调用：协程发出的一段写完了，连接可以继续执行
+    void ready(http_conn *conn);
+    // 任意线程调用：连接关闭，挂起在它上面的协程不再继续
+    void closed(int fd);
+
+    // 以下只能由主线程调用
+    // 取出可以继续执行的连接：到期的定时器、完成的阻塞任务和写完的一段
+    void poll(std::vector<http_conn *> &out);
+    // 事件循环最多等待的毫秒数，不超过limit
+    int timeout(int limit) const;
+
+private:
+    coro_scheduler();
+    ~coro_scheduler();
+
+    static void *worker(void *arg);
+    void run();
+    void wake();
+    // 协程等的事件到了，连接已经关闭时销毁协程帧
+    void fire(coro_task::promise_type *p, std::vector<http_conn *> &out);
+    // 取消挂起的协程，调用者持有m_lock
+    void cancel(coro_task::promise_type *p);
+
+private:
+    int m_wake_fd;
+    // 有新的挂起、完成或写完的连接，poll需要加锁取走
+    std::atomic<bool> m_pending;
+    locker m_lock;
+    std::vector<coro_task::promise_type *> m_incoming;
+    std::vector<coro_task::promise_type *> m_done;
+    std::vector<http_conn *> m_flushed;
+    // 每个fd上挂起的协程，关闭连接时据此取消
+    std::vector<coro_task::promise_type *> m_parked;
+    // poll取走的一批，保留容量
+    std::vector<coro_task::promise_type *> m_take_incoming;
+    std::vector<coro_task::promise_type *> m_take_done;
+    std::vector<http_conn *> m_take_flushed;
+
+    // 按到期时间排序的定时器，只有主线程访问
+    typedef std::pair<int64_t, coro_task::promise_type *> timer_entry;
+    std::priority_queue<timer_entry, std::vector<timer_entry>, std::greater<timer_entry>> m_timers;
+
+    // 阻塞任务队列，由init创建的线程执行
+    std::queue<coro_task::promise_type *> m_jobs;
+    locker m_job_lock;
+    sem m_job_stat;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <strings.h>
+#include "handler.h"
+
+const char *request_view::header(const char *name) const
+{
+    // 请求头通常只有十来个，逐个比较比为大小写建索引划算
+    for (const auto &kv : *headers)
+        if (strcasecmp(kv.first.c_str(), name) == 0)
+            return kv.second.c_str();
+    return NULL;
+}
+
+const char *request_view::form(const char *key) const
+{
+    std::unordered_map<std::string, std::string>::const_iterator it = fields->find(key);
+    return it == fields->end() ? NULL : it->second.c_str();
+}
+
+void response_builder::reset(std::string *body)
+{
+    m_status = 200;
+    m_type = "text/plain";
+    m_headers.clear();
+    m_body = body;
+    m_stream.reset();
+}
+
+void response_builder::header(const char *name, const char *value)
+{
+    m_headers += name;
+    m_headers += ':';
+    m_headers += value;
+    m_headers += "\r\n";
+}
+
+void response_builder::printf(const char *format, ...)
+{
+    char line[512];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(line, sizeof(line), format, arg_list);
+    va_end(arg_list);
+    if (len < 0)
+        return;
+    if ((size_t)len < sizeof(line))
+    {
+        m_body->append(line, len);
+        return;
+    }
+    // 放不下时直接格式化到响应体末尾
+    size_t old = m_body->size();
+    m_body->resize(old + len + 1);
+    va_start(arg_list, format);
+    vsnprintf(&(*m_body)[old], len + 1, format, arg_list);
+    va_end(arg_list);
+    m_body->resize(old + len);
+}
@@ -0,0 +1,83 @@
+/*************************************************************
+*动态接口
+*按方法和路径注册处理函数，请求匹配到时在线程池的工作线程中调用，
+*处理函数读请求视图、往响应构造器里写状态码、头和响应体，
+*不经过文件系统，长连接上和静态文件一样直接由工作线程发送
+**************************************************************/
+
+#ifndef HTTP_HANDLER_H
+#define HTTP_HANDLER_H
+
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "stream.h"
+#include "coro.h"
+
+// 注册时允许的方法，与http_conn::METHOD对应，可以按位或
+static const int ROUTE_GET = 1 << 0;
+static const int ROUTE_POST = 1 << 1;
+
+// 处理函数看到的请求，指针都指向连接的读缓冲区，只在处理函数执行期间有效
+struct request_view
+{
+    // http_conn::METHOD
+    int method;
+    // 不含查询串的路径
+    const char *path;
+    size_t path_len;
+    // ?之后的查询串，没有时为空串
+    const char *query;
+    size_t query_len;
+    // 请求体，没有时为空串
+    const char *body;
+    size_t body_len;
+
+    // 请求头的值，名字不区分大小写，没有时返回NULL
+    const char *header(const char *name) const;
+    // application/x-www-form-urlencoded请求体里的字段，没有时返回NULL
+    const char *form(const char *key) const;
+
+    const std::unordered_map<std::string, std::string> *headers;
+    const std::unordered_map<std::string, std::string> *fields;
+};
+
+// 处理函数填写的响应，默认200、text/plain、空响应体
+class response_builder
+{
+public:
+    response_builder() : m_body(NULL) { reset(NULL); }
+
+    void status(int code) { m_status = code; }
+    void type(const char *content_type) { m_type = content_type; }
+    // 额外的响应头，和其余响应头一起要放得进连接的写缓冲区
+    void header(const char *name, const char *value);
+    void write(const char *data, size_t len) { m_body->append(data, len); }
+    void write(const char *s) { m_body->append(s); }
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    // 长度事先未知的响应体改用生产者边发边生成，生产者归连接所有，写进body的内容被忽略
+    void stream(stream_source *src) { m_stream.reset(src); }
+
+    // 以下由http_conn使用
+    // 每个请求开始前清空，body是连接的响应体缓冲区
+    void reset(std::string *body);
+    int status() const { return m_status; }
+    const char *type() const { return m_type.c_str(); }
+    const std::string &headers() const { return m_headers; }
+    std::unique_ptr<stream_source> &stream() { return m_stream; }
+
+private:
+    int m_status;
+    std::string m_type;
+    std::string m_headers;
+    std::string *m_body;
+    std::unique_ptr<stream_source> m_stream;
+};
+
+typedef std::function<void(const request_view &req, response_builder &res)> request_handler;
+// 协程处理函数，req和res在协程结束前一直有效，co_await的用法见coro.h
+typedef std::function<coro_task(const request_view &req, response_builder &res)> coro_handler;
+
+#endif
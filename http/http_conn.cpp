@@ -6,8 +6,9 @@
  * add getfiletype()  to render html
  */
 #include "http_conn.h"
-#include <mysql/mysql.h>
+#include "../threadpool/admission.h"
 #include <fstream>
+#include <list>
 using namespace std;
 
 
@@ -33,12 +34,109 @@ const unordered_map<string, string> http_conn::SUFFIX_TYPE = {
     { ".js",    "text/javascript "},
 };
 
-const unordered_set<string> http_conn::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+// 页面每次都向服务器验证，命中时只回304；样式、脚本和图片直接用本地缓存
+const vector<pair<string, string>> http_conn::CACHE_CONTROL = {
+    { "/",           "no-cache" },
+    { "/css/",       "public, max-age=86400" },
+    { "/js/",        "public, max-age=86400" },
+    { "/coollogin/", "public, max-age=86400" },
+    { "/fonts/",     "public, max-age=604800" },
+    { "/images/",    "public, max-age=604800" },
+};
+
+// 处理函数的编号，对应HANDLERS的下标
+enum
+{
+    H_METRICS = 0,
+    H_TRACES,
+    H_LOGIN,
+    H_REGISTER,
+    // 之后是add_handler和add_coro_handler注册的动态接口
+    H_USER
+};
+const http_conn::route_handler http_conn::HANDLERS[] = {
+    &http_conn::handle_metrics,
+    &http_conn::handle_traces,
+    &http_conn::handle_login,
+    &http_conn::handle_register,
+};
+
+// 路由表，没有匹配的路径按原样在网站根目录下找文件
+static const route ROUTES[] = {
+    // 保留路径，响应体直接生成
+    {"/metrics", ROUTE_GET, false, NULL, H_METRICS},
+    {"/traces", ROUTE_GET, false, NULL, H_TRACES},
+    // 登录注册表单提交到不带后缀的路径
+    {"/login", ROUTE_POST, false, NULL, H_LOGIN},
+    {"/login.html", ROUTE_POST, false, NULL, H_LOGIN},
+    {"/register", ROUTE_POST, false, NULL, H_REGISTER},
+    {"/register.html", ROUTE_POST, false, NULL, H_REGISTER},
+    // 页面可以省略.html
+    {"/", ROUTE_GET | ROUTE_POST, false, "/index.html", -1},
+    {"/index", ROUTE_GET | ROUTE_POST, false, "/index.html", -1},
+    {"/register", ROUTE_GET, false, "/register.html", -1},
+    {"/login", ROUTE_GET, false, "/login.html", -1},
+    {"/welcome", ROUTE_GET, false, "/welcome.html", -1},
+    {"/video", ROUTE_GET, false, "/video.html", -1},
+    {"/picture", ROUTE_GET, false, "/picture.html", -1},
+    // 原版页面用的数字路径
+    {"/0", ROUTE_GET | ROUTE_POST, false, "/register.html", -1},
+    {"/1", ROUTE_GET | ROUTE_POST, false, "/log.html", -1},
+    {"/5", ROUTE_GET | ROUTE_POST, false, "/picture.html", -1},
+    {"/6", ROUTE_GET | ROUTE_POST, false, "/video.html", -1},
+    {"/7", ROUTE_GET | ROUTE_POST, false, "/fans.html", -1},
+};
+
+// 注册的动态接口，普通函数和协程二者只有一个非空，路由表建好后只读
+struct user_handler
+{
+    request_handler fn;
+    coro_handler coro;
+};
+static std::vector<user_handler> g_handlers;
+static std::vector<route> g_handler_routes;
+// 路由里的路径指向这里，list扩容时不移动元素
+static std::list<std::string> g_handler_paths;
+static bool g_routes_built = false;
+
+static router build_routes()
+{
+    router r;
+    // 注册的接口排在前面，同一路径同一方法时覆盖内置的路由
+    for (const route &rt : g_handler_routes)
+        r.add(rt);
+    for (const route &rt : ROUTES)
+        r.add(rt);
+    r.build();
+    g_routes_built = true;
+    return r;
+}
+
+static bool add_user_handler(int methods, const char *path, const user_handler &h, bool prefix)
+{
+    if (g_routes_built || !path || path[0] != '/')
+        return false;
+    g_handler_paths.push_back(path);
+    g_handler_routes.push_back(route{g_handler_paths.back().c_str(), methods, prefix, NULL, H_USER + (int)g_handlers.size()});
+    g_handlers.push_back(h);
+    return true;
+}
 
-const unordered_map<string, int> http_conn::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+bool http_conn::add_handler(int methods, const char *path, const request_handler &fn, bool prefix)
+{
+    return add_user_handler(methods, path, user_handler{fn, nullptr}, prefix);
+}
+
+bool http_conn::add_coro_handler(int methods, const char *path, const coro_handler &fn, bool prefix)
+{
+    return add_user_handler(methods, path, user_handler{nullptr, fn}, prefix);
+}
+
+const router &http_conn::routes()
+{
+    static const router r = build_routes();
+    return r;
+}
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -50,41 +148,43 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
-// 互斥锁对象
-locker m_lock;
-// 数据库用户密码
-map<string, string> users;
-
-// 初始化数据库连接
-void http_conn::initmysql_result(connection_pool *connPool)
+const char *not_modified_304_title = "Not Modified";
+const char *partial_206_title = "Partial Content";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is not satisfiable.\n";
+const char *error_429_form = "Too many requests from this address, please slow down.\n";
+// 动态接口可以回任意状态码，常见的给出标准的原因短语
+static const char *status_title(int status)
 {
-    //先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    //在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
+    switch (status)
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+    case 200: return ok_200_title;
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return not_modified_304_title;
+    case 307: return "Temporary Redirect";
+    case 400: return error_400_title;
+    case 401: return "Unauthorized";
+    case 403: return error_403_title;
+    case 404: return error_404_title;
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 422: return "Unprocessable Entity";
+    case 429: return "Too Many Requests";
+    case 500: return error_500_title;
+    case 503: return "Service Unavailable";
+    default: return status < 400 ? ok_200_title : error_500_title;
     }
 }
+// 默认不提供登录注册，启动时按配置替换
+credential_store *http_conn::m_credentials = credential_store::none();
+bool http_conn::m_autoindex = false;
+off_t http_conn::m_large_file = 0;
 
 //对文件描述符设置非阻塞
 void setnonblocking(int fd)
@@ -118,22 +218,42 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     // 防止同一个通信被不同的线程处理
     if (one_shot)
         event.events |= EPOLLONESHOT;
+    // io_uring后端不注册epoll，请主线程提交第一次接收
+    if (uring::get_instance()->enabled())
+    {
+        uring::get_instance()->arm(fd, EPOLLIN);
+        return;
+    }
     // 添加监听连接句柄作为初始节点进入红黑树结构中，该节点后续处理连接的句柄
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    // 设置文件描述符非阻塞
-    setnonblocking(fd);
+    metrics::get_instance()->count(METRIC_EPOLL_CTL);
+    // 连接由accept4直接创建为非阻塞，不再需要两次fcntl
 }
 
 // 从epoll中删除文件描述符，从内核事件表删除描述符
 void removefd(int epollfd, int fd)
 {
+    // 挂起在这个连接上的协程不再继续
+    coro_scheduler::get_instance()->closed(fd);
+    if (uring::get_instance()->enabled())
+    {
+        uring::get_instance()->close_fd(fd);
+        return;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    metrics::get_instance()->count(METRIC_EPOLL_CTL);
     close(fd);
 }
 
 // 修改文件描述符，重置socket上EPOLLONESHOT事件，确保下一次可读时，EPOLLIN事件能被触发
 void modfd(int epollfd, int fd, int ev, int TRIGMode)
 {
+    // io_uring后端下EPOLLIN/EPOLLOUT表示请主线程提交接收/发送
+    if (uring::get_instance()->enabled())
+    {
+        uring::get_instance()->arm(fd, ev);
+        return;
+    }
     epoll_event event;
     event.data.fd = fd;
 
@@ -143,9 +263,10 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
         event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
 
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    metrics::get_instance()->count(METRIC_EPOLL_CTL);
 }
 // 所有的客户数
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 // 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
 int http_conn::m_epollfd = -1;
 
@@ -169,7 +290,15 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 {
     m_sockfd = sockfd;
     m_address = addr;
+    // 触发模式要在注册epoll之前设置，否则用的是该槽位上一个连接的模式
+    m_TRIGMode = TRIGMode;
+    // 工作线程在一次响应结束时会调用init()，reactor的完成标记只在新连接时清零，
+    // 否则长连接的响应在工作线程里发完会把刚置位的improv清掉，主线程一直忙等
+    timer_flag = 0;
+    improv = 0;
+    m_shed = false;
     // 添加到epoll对象中，新的客户连接置为EPOLLONESHOT事件
+    m_armed = EPOLLIN;
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     // 总用户数+1
     m_user_count++;
@@ -177,8 +306,6 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     // 网站的根目录
     doc_root = root;
-    // 触发模式
-    m_TRIGMode = TRIGMode;
     // 日志写入方式
     m_close_log = close_log;
 
@@ -193,9 +320,16 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_iv.clear();
+    m_iv_idx = 0;
+    // 上一个连接在流式响应中途关闭时，生产者留到槽位复用时才释放
+    m_stream.reset();
+    m_stream_last = false;
+    // 同样，协程在等写完时连接被关闭，留到这里销毁
+    m_coro.reset();
+    m_coro_flushed = false;
     // 初始化状态为解析请求首行
     m_check_state = CHECK_STATE_REQUESTLINE;
     // 默认不保持连接  Connection:keep-alive保持连接
@@ -211,8 +345,25 @@ void http_conn::init()
     m_write_idx = 0;
     cgi = 0;
     m_state = 0;
-    timer_flag = 0;
-    improv = 0;
+    m_req_start_ns = 0;
+    m_write_start_ns = 0;
+    m_status = 0;
+    m_body_dynamic = false;
+    m_file_len = 0;
+    m_accept_enc = ENC_IDENTITY;
+    m_content_enc = ENC_IDENTITY;
+    m_vary = false;
+    m_etag[0] = '\0';
+    m_cache_control = NULL;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_range_count = 0;
+    m_body_type = NULL;
+    m_response.reset(&m_body);
+    m_pipelined = false;
+    m_trace.reset();
 
     method_ = path_ = version_ = body_ = "";
     state_ = CHECK_STATE_REQUESTLINE;
@@ -289,6 +440,8 @@ bool http_conn::read_once()
         {
             return false;
         }
+        if (0 == m_req_start_ns)
+            m_req_start_ns = metrics::now_ns();
 
         return true;
     }
@@ -313,6 +466,8 @@ bool http_conn::read_once()
                 // 对方关闭连接
                 return false;
             }
+            if (0 == m_req_start_ns)
+                m_req_start_ns = metrics::now_ns();
             m_read_idx += bytes_read;
         }
         return true;
@@ -329,7 +484,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if(!ParseRequestLine_(temp)){
         return BAD_REQUEST;
     }
-    ParsePath_();
     // // 主状态机检查状态变成检查请求头
     // m_check_state = CHECK_STATE_HEADER;
     // return NO_REQUEST;
@@ -393,9 +547,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     // 判断url是否正确
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示index界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "/index.html");
     // 主状态机检查状态变成检查请求头
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
@@ -442,19 +593,6 @@ void http_conn::ParseBody_(const string& line) {
     LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
 }
 
-void http_conn::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; 
-    }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
-    }
-}
 // 转换十六进制为十进制
 int http_conn::ConverHex(char ch) {
     if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
@@ -465,21 +603,6 @@ int http_conn::ConverHex(char ch) {
 void http_conn::ParsePost_() {
     if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
         ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["user"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                    strcpy(m_url, "/welcome.html");
-                } 
-                else {
-                    path_ = "/error.html";
-                    strcpy(m_url, "/error.html");
-                }
-            }
-        }
     }   
 }
 // 处理请求体
@@ -526,162 +649,17 @@ void http_conn::ParseFromUrlencoded_() {
 
 bool http_conn::UserVerify(const string &name, const string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false; }
-    // flag 标记用户名被使用(false),未被使用true;
-    bool flag = false;
     LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    // if(!isLogin) { flag = true; }
-    // 登录行为
-    if(isLogin){
-        if(users.find(name) != users.end()){
-            if(users[name] == pwd){
-                LOG_DEBUG( "UserVerify success!!");
-                flag = true;
-            }
-            else{
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        }else{
-            LOG_DEBUG("user not found!");
-            flag = false;
-        }
-    }
-    // 注册行为
-    else{
-        // 用户名被使用
-        if(users.find(name) != users.end()){
-            LOG_DEBUG("user used!");
-            flag = false;
-        }else{
-            /* 注册行为 且 用户名未被使用*/
-            LOG_DEBUG("regirster!");
-            char order[256] = { 0 };
-            bzero(order, 256);
-            snprintf(order, 256,"INSERT INTO user(username, passwd) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-            LOG_DEBUG( "%s", order);
-            m_lock.lock();
-            // 插入数据库失败
-            if(mysql_query(mysql, order)) { 
-                LOG_DEBUG( "Insert error!");
-                flag = false; 
-                strcpy(m_url, "/registerError.html");
-            }else{
-                users.insert(pair<string, string>(name, pwd));
-                LOG_DEBUG( "Insert Success!");
-                flag = true;
-                // 注册成功，m_url变为登录地址
-                strcpy(m_url, "/login.html");
-            }
-            m_lock.unlock();
-        }
-    }
-    // 用户名找到
-    if(users.find(name) != users.end()){
-        if(isLogin){
-            if(users[name] == pwd){
-                LOG_DEBUG( "UserVerify success!!");
-                flag = true;
-            }
-            else{
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        }else{
-            flag = false;
-            LOG_DEBUG("user used!");
-        }
+    // 凭据后端的耗时计入数据库阶段
+    m_trace.begin(TRACE_DB_START);
+    bool flag = isLogin ? m_credentials->verify(name, pwd) : m_credentials->add_user(name, pwd);
+    m_trace.end(TRACE_DB_END);
+    if(flag){
+        LOG_DEBUG(isLogin ? "UserVerify success!!" : "Insert Success!");
     }else{
-        if(isLogin){
-            LOG_DEBUG("user not found!");
-            flag = true;
-        }else{
-            /* 注册行为 且 用户名未被使用*/
-            LOG_DEBUG("regirster!");
-            char order[256] = { 0 };
-            bzero(order, 256);
-            snprintf(order, 256,"INSERT INTO user(username, passwd) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-            LOG_DEBUG( "%s", order);
-            m_lock.lock();
-            // 插入数据库失败
-            if(mysql_query(mysql, order)) { 
-                LOG_DEBUG( "Insert error!");
-                flag = false; 
-                strcpy(m_url, "/registerError.html");
-            }else{
-                users.insert(pair<string, string>(name, pwd));
-                LOG_DEBUG( "Insert Success!");
-                flag = true;
-                // 注册成功，m_url变为登录地址
-                strcpy(m_url, "/login.html");
-            }
-            m_lock.unlock();
-        }
-    }
-
-    
-
-
-    if (users.find(name) != users.end() && users[name] == pwd){
-        LOG_DEBUG( "UserVerify success!!");
-        return true;
+        LOG_DEBUG(isLogin ? "user not found or pwd error!" : "user used or insert error!");
     }
-    return false;
-    // MYSQL* sql;
-    // SqlConnRAII(&sql,  SqlConnPool::Instance());
-    // assert(sql);
-    
-    // bool flag = false;
-    // unsigned int j = 0;
-    // char order[256] = { 0 };
-    // MYSQL_FIELD *fields = nullptr;
-    // MYSQL_RES *res = nullptr;
-    
-    // if(!isLogin) { flag = true; }
-    // /* 查询用户及密码 */
-    // snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    // LOG_DEBUG("%s", order);
-
-    // if(mysql_query(sql, order)) { 
-    //     mysql_free_result(res);
-    //     return false; 
-    // }
-    // res = mysql_store_result(sql);
-    // j = mysql_num_fields(res);
-    // fields = mysql_fetch_fields(res);
-
-    // while(MYSQL_ROW row = mysql_fetch_row(res)) {
-    //     LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-    //     string password(row[1]);
-    //     /* 注册行为 且 用户名未被使用*/
-    //     if(isLogin) {
-    //         if(pwd == password) { flag = true; }
-    //         else {
-    //             flag = false;
-    //             LOG_DEBUG("pwd error!");
-    //         }
-    //     } 
-    //     else { 
-    //         flag = false; 
-    //         LOG_DEBUG("user used!");
-    //     }
-    // }
-    // mysql_free_result(res);
-
-    // /* 注册行为 且 用户名未被使用*/
-    // if(!isLogin && flag == true) {
-    //     LOG_DEBUG("regirster!");
-    //     bzero(order, 256);
-    //     snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-    //     LOG_DEBUG( "%s", order);
-    //     if(mysql_query(sql, order)) { 
-    //         LOG_DEBUG( "Insert error!");
-    //         flag = false; 
-    //     }
-    //     flag = true;
-    // }
-    // SqlConnPool::Instance()->FreeConn(sql);
-    // LOG_DEBUG( "UserVerify success!!");
-    // return flag;
+    return flag;
 }
 
 //解析http请求的一个头部信息
@@ -724,6 +702,38 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_content_length = atol(text);
     }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        // 处理Accept-Encoding头部字段，记下客户端接受的压缩编码
+        text += 16;
+        text += strspn(text, " \t");
+        m_accept_enc = compress_cache::parse_accept(text);
+    }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+    {
+        // 处理If-None-Match头部字段，客户端缓存的ETag列表
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "If-Modified-Since:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        m_if_modified_since = text;
+    }
+    else if (strncasecmp(text, "Range:", 6) == 0)
+    {
+        text += 6;
+        text += strspn(text, " \t");
+        m_range = text;
+    }
+    else if (strncasecmp(text, "If-Range:", 9) == 0)
+    {
+        text += 9;
+        text += strspn(text, " \t");
+        m_if_range = text;
+    }
     else if (strncasecmp(text, "Host:", 5) == 0)
     {
         // 处理Host头部字段
@@ -791,7 +801,9 @@ http_conn::HTTP_CODE http_conn::process_read()
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
-                return do_request();
+                ret = do_request();
+                m_trace.end(TRACE_FS_END);
+                return ret;
             }
             break;
         }
@@ -799,7 +811,11 @@ http_conn::HTTP_CODE http_conn::process_read()
         {
             ret = parse_content(text);
             if (ret == GET_REQUEST)
-                return do_request();
+            {
+                ret = do_request();
+                m_trace.end(TRACE_FS_END);
+                return ret;
+            }
             line_status = LINE_OPEN;
             break;
         }
@@ -810,138 +826,257 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
-// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
-http_conn::HTTP_CODE http_conn::do_request()
+// 保留路径，响应体直接生成，不对应磁盘文件
+http_conn::HTTP_CODE http_conn::handle_metrics(const char *&)
 {
-
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    // 找到第一个出现字符的位置
-    const char *p = strrchr(m_url, '/');
-
-    //处理cgi；应该就是post
-    // 2是login；3是register
-    /*
-    if (m_method == POST && (*(p + 1) == '2' || *(p + 1) == '3'))
+    metrics::get_instance()->set_gauge(METRIC_CONNECTIONS, m_user_count.load());
+    m_body = metrics::get_instance()->render();
+    m_body_type = "text/plain; version=0.0.4";
+    m_cache_control = "no-store";
+    return DYNAMIC_REQUEST;
+}
+http_conn::HTTP_CODE http_conn::handle_traces(const char *&)
+{
+    m_body = tracer::get_instance()->dump_chrome();
+    m_body_type = "application/json";
+    m_cache_control = "no-store";
+    return DYNAMIC_REQUEST;
+}
+void http_conn::fill_view(size_t path_len)
+{
+    m_view.method = m_method;
+    m_view.path = m_url;
+    m_view.path_len = path_len;
+    m_view.query = '?' == m_url[path_len] ? m_url + path_len + 1 : "";
+    m_view.query_len = strlen(m_view.query);
+    m_view.body = m_content_length > 0 ? m_string : "";
+    m_view.body_len = m_content_length;
+    m_view.headers = &header_;
+    m_view.fields = &post_;
+    // 长连接上m_body还留着上一个响应的内容
+    m_body.clear();
+}
+http_conn::HTTP_CODE http_conn::call_handler(const request_handler &fn, size_t path_len)
+{
+    fill_view(path_len);
+    // 处理函数的异常不能带走工作线程
+    try
     {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        // char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        // strcpy(m_url_real, "/");
-        // strcat(m_url_real, m_url + 2);
-        // strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        // free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&password=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3')
+        fn(m_view, m_response);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("handler for %s threw: %s", m_url, e.what());
+        // 处理函数已经设置的状态码和响应头不能带到500响应上
+        m_response.reset(&m_body);
+        return INTERNAL_ERROR;
+    }
+    catch (...)
+    {
+        LOG_ERROR("handler for %s threw", m_url);
+        m_response.reset(&m_body);
+        return INTERNAL_ERROR;
+    }
+    m_body_type = m_response.type();
+    if (m_response.stream())
+    {
+        m_stream = std::move(m_response.stream());
+        return STREAM_REQUEST;
+    }
+    return DYNAMIC_REQUEST;
+}
+http_conn::HTTP_CODE http_conn::call_coro(const coro_handler &fn, size_t path_len)
+{
+    fill_view(path_len);
+    // 协程体里的异常由promise保存；coro_handler可以是任意返回coro_task的函数，在创建协程帧之前也可能抛出任何类型
+    try
+    {
+        m_coro = fn(m_view, m_response);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("handler for %s threw: %s", m_url, e.what());
+        m_response.reset(&m_body);
+        return INTERNAL_ERROR;
+    }
+    catch (...)
+    {
+        LOG_ERROR("handler for %s threw", m_url);
+        m_response.reset(&m_body);
+        return INTERNAL_ERROR;
+    }
+    m_coro.promise().conn = this;
+    m_coro.promise().fd = m_sockfd;
+    return resume_coro();
+}
+http_conn::HTTP_CODE http_conn::resume_coro()
+{
+    // 上一段已经写完，响应体重新开始积累
+    if (CORO_FLUSH == m_coro.promise().wait)
+        m_body.clear();
+    m_coro.promise().wait = CORO_NONE;
+    m_coro.resume();
+    if (!m_coro.done())
+        return CORO_REQUEST;
+    std::exception_ptr error = m_coro.promise().error;
+    m_coro.reset();
+    if (error)
+    {
+        try
         {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(string(name)) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    // 注册成功，m_url变为登录地址
-                    strcpy(m_url, "/login.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
+            std::rethrow_exception(error);
         }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
+        catch (const std::exception &e)
         {
-            if (users.find(string(name)) != users.end() && users[name] == string(password))
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/error.html");
+            LOG_ERROR("handler for %s threw: %s", m_url, e.what());
         }
+        catch (...)
+        {
+            LOG_ERROR("handler for %s threw", m_url);
+        }
+        // 响应头已经发出时只能关闭连接，否则丢掉协程设置的响应头，改发500
+        if (m_coro_flushed)
+            return CLOSED_CONNECTION;
+        m_response.reset(&m_body);
+        return INTERNAL_ERROR;
     }
-    */
-
-    if (*(p + 1) == '0')
+    // 发出过一段的，剩下的响应体和结束块作为最后一段
+    if (m_coro_flushed)
+        return CORO_REQUEST;
+    m_body_type = m_response.type();
+    if (m_response.stream())
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        m_stream = std::move(m_response.stream());
+        return STREAM_REQUEST;
     }
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return DYNAMIC_REQUEST;
+}
+// 登录注册的结果都是一个页面
+http_conn::HTTP_CODE http_conn::handle_login(const char *&file)
+{
+    file = UserVerify(post_["user"], post_["password"], true) ? "/welcome.html" : "/error.html";
+    return GET_REQUEST;
+}
+http_conn::HTTP_CODE http_conn::handle_register(const char *&file)
+{
+    // 注册要写数据库，同时进行的太多时直接拒绝，不去排队等连接
+    db_ticket ticket;
+    if (!ticket)
+        return SERVICE_UNAVAILABLE;
+    file = UserVerify(post_["user"], post_["password"], false) ? "/welcome.html" : "/error.html";
+    return GET_REQUEST;
+}
 
-        free(m_url_real);
+// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
+// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
+// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+http_conn::HTTP_CODE http_conn::do_request()
+{
+
+    // 按路由表决定要发送什么：处理函数、别名页面或挂载目录下的文件，都不匹配时按路径找文件。
+    // 路由和文件名都不含查询串
+    size_t path_len = strcspn(m_url, "?");
+    size_t matched = 0;
+    // 限速在登录注册、动态接口和文件访问之前，超过的请求不碰数据库和文件系统
+    if (!rate_limiter::get_instance()->allow(m_method, m_url, path_len, m_address.sin_addr.s_addr, m_retry_after))
+        return TOO_MANY_REQUESTS;
+    const route *r = routes().match(m_method, m_url, path_len, matched);
+    const char *dir = "";
+    const char *file = m_url;
+    size_t file_len = path_len;
+    if (r && r->handler >= H_USER)
+    {
+        const user_handler &h = g_handlers[r->handler - H_USER];
+        return h.coro ? call_coro(h.coro, path_len) : call_handler(h.fn, path_len);
     }
-    else if (*(p + 1) == '5')
+    if (r && r->handler >= 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        HTTP_CODE ret = (this->*HANDLERS[r->handler])(file);
+        if (ret != GET_REQUEST)
+            return ret;
+        file_len = strlen(file);
     }
-    else if (*(p + 1) == '6')
+    else if (r && r->prefix)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        // 挂载：前缀换成目标目录，其余部分照搬
+        dir = r->target ? r->target : "";
+        file += matched;
+        file_len -= matched;
     }
-    else if (*(p + 1) == '7')
+    else if (r && r->target)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        file = r->target;
+        file_len = strlen(file);
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+
+    m_trace.begin(TRACE_FS_START);
+
+    snprintf(m_real_file, FILENAME_LEN, "%s%s%.*s", doc_root, dir, (int)file_len, file);
     // 获取m_real_file文件的相关的状态信息， -1失败， 0成功
-    if (stat(m_real_file, &m_file_stat) < 0 || S_ISDIR(m_file_stat.st_mode))
+    if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
 
     // 判断访问权限
     if (!(m_file_stat.st_mode & S_IROTH))
         return FORBIDDEN_REQUEST;
-    // 判断是否是目录
+    // 目录只在开启autoindex时列出，列表边读目录边发送
     if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+    {
+        // 标题和链接只用路径，不带查询串
+        std::string url(m_url, path_len);
+        if (!m_autoindex || url.find("/..") != std::string::npos)
+            return NO_RESOURCE;
+        m_stream.reset(dir_listing::open(m_real_file, url.c_str()));
+        if (!m_stream)
+            return NO_RESOURCE;
+        m_body_type = m_stream->content_type();
+        m_cache_control = "no-cache";
+        return STREAM_REQUEST;
+    }
+    m_file_len = m_file_stat.st_size;
+    // 文本类的文件可以协商压缩编码
+    m_vary = m_file_len > 0 && compress_cache::compressible(GetFileType_().c_str());
+
+    // 缓存验证：ETag由inode、大小和纳秒级修改时间组成，文件不变就不变
+    snprintf(m_etag, sizeof(m_etag), "%lx-%lx-%llx", (unsigned long)m_file_stat.st_ino,
+             (unsigned long)m_file_stat.st_size,
+             (unsigned long long)m_file_stat.st_mtim.tv_sec * 1000000000ULL + m_file_stat.st_mtim.tv_nsec);
+    size_t best = 0;
+    for (const pair<string, string> &rule : CACHE_CONTROL)
+    {
+        if (rule.first.size() > best && strncmp(m_url, rule.first.c_str(), rule.first.size()) == 0)
+        {
+            best = rule.first.size();
+            m_cache_control = rule.second.c_str();
+        }
+    }
+    // 客户端缓存的版本仍然有效时不打开也不映射文件
+    if (not_modified())
+        return NOT_MODIFIED;
+
+    // 区间请求只针对原文件，不压缩；区间都不可满足时不打开文件
+    if (m_range && m_file_len > 0)
+    {
+        m_range_count = parse_range();
+        if (m_range_count < 0)
+        {
+            m_range_count = 0;
+            return RANGE_NOT_SATISFIABLE;
+        }
+    }
+    // 内容协商：文本类的文件按客户端接受的编码发送压缩后的内容
+    if (!m_range_count && m_vary && m_accept_enc && open_encoded())
+        return FILE_REQUEST;
+    // 大文件按窗口读进池化的缓冲区，连接占用的内存与文件大小无关；多区间仍然映射
+    if (m_large_file > 0 && m_file_len >= m_large_file && m_range_count <= 1)
+    {
+        off_t offset = m_range_count ? m_range_first[0] : 0;
+        off_t len = m_range_count ? m_range_last[0] - m_range_first[0] + 1 : m_file_len;
+        m_stream.reset(file_window::open(m_real_file, offset, len));
+        if (!m_stream)
+            return INTERNAL_ERROR;
+        return FILE_REQUEST;
+    }
     // 以只读方式打开文件
     int fd = open(m_real_file, O_RDONLY);
     // 创建内存映射
@@ -951,14 +1086,235 @@ http_conn::HTTP_CODE http_conn::do_request()
     close(fd);
     return FILE_REQUEST;
 }
+// If-None-Match按弱比较，列表里有当前版本的ETag就算命中；压缩版本的ETag带编码后缀，
+// 客户端仍然接受该编码时也算命中。没有If-None-Match时才看If-Modified-Since
+bool http_conn::not_modified()
+{
+    if (m_if_none_match)
+    {
+        size_t len = strlen(m_etag);
+        const char *p = m_if_none_match;
+        while (*p)
+        {
+            p += strspn(p, " \t,");
+            if ('*' == *p)
+                return true;
+            if (strncmp(p, "W/", 2) == 0)
+                p += 2;
+            if ('"' != *p)
+                break;
+            const char *tag = ++p;
+            const char *end = strchr(tag, '"');
+            if (!end)
+                break;
+            p = end + 1;
+            if ((size_t)(end - tag) < len || strncmp(tag, m_etag, len) != 0)
+                continue;
+            const char *rest = tag + len;
+            if (rest == end)
+            {
+                m_content_enc = ENC_IDENTITY;
+                return true;
+            }
+            static const int ENCODINGS[] = {ENC_BR, ENC_GZIP};
+            for (int enc : ENCODINGS)
+            {
+                if ((m_accept_enc & enc) && end - rest == 3 && '-' == rest[0] &&
+                    strncmp(rest + 1, compress_cache::suffix(enc) + 1, 2) == 0)
+                {
+                    m_content_enc = enc;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    if (m_if_modified_since)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        // 只认RFC 7231的IMF-fixdate，其余格式当作没有这个头
+        const char *end = strptime(m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return end && '\0' == *end && m_file_stat.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
+// Range: bytes=0-499,1000-,-200
+// 语法错误、区间过多、If-Range不匹配或者区间总长超过文件本身时忽略Range，发送整个文件
+int http_conn::parse_range()
+{
+    if (m_if_range)
+    {
+        // If-Range用强比较，只有未压缩版本的ETag或者完全相同的Last-Modified才算匹配
+        if ('"' == m_if_range[0])
+        {
+            size_t len = strlen(m_etag);
+            if (strncmp(m_if_range + 1, m_etag, len) != 0 || strcmp(m_if_range + 1 + len, "\"") != 0)
+                return 0;
+        }
+        else
+        {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            const char *end = strptime(m_if_range, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            if (!end || '\0' != *end || timegm(&tm) != m_file_stat.st_mtime)
+                return 0;
+        }
+    }
+    if (strncasecmp(m_range, "bytes=", 6) != 0)
+        return 0;
+    const char *p = m_range + 6;
+    int count = 0;
+    off_t total = 0;
+    bool any = false;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (!*p)
+            break;
+        char *end;
+        off_t first, last;
+        if ('-' == *p)
+        {
+            // 后缀区间，最后n个字节
+            off_t n = strtoll(p + 1, &end, 10);
+            if (end == p + 1 || n < 0)
+                return 0;
+            first = n < m_file_len ? m_file_len - n : 0;
+            last = n > 0 ? m_file_len - 1 : -1;
+        }
+        else
+        {
+            first = strtoll(p, &end, 10);
+            if (end == p || '-' != *end || first < 0)
+                return 0;
+            p = end + 1;
+            last = strtoll(p, &end, 10);
+            if (end == p)
+                last = m_file_len - 1;
+            else if (last < first)
+                return 0;
+            if (last >= m_file_len)
+                last = m_file_len - 1;
+        }
+        p = end;
+        p += strspn(p, " \t");
+        if (*p && ',' != *p)
+            return 0;
+        any = true;
+        // 起点在文件之外的区间不可满足，跳过
+        if (first > last)
+            continue;
+        if (count == MAX_RANGES)
+            return 0;
+        m_range_first[count] = first;
+        m_range_last[count] = last;
+        total += last - first + 1;
+        ++count;
+    }
+    if (!any)
+        return 0;
+    if (0 == count)
+        return -1;
+    // 重叠的区间反复请求同一段数据，直接发整个文件
+    if (total > m_file_len)
+        return 0;
+    return count;
+}
+off_t http_conn::fill_ranges()
+{
+    // m_iv[0]已经留给响应头，响应头要等知道了响应体长度才能生成
+    if (1 == m_range_count)
+    {
+        size_t len = m_range_last[0] - m_range_first[0] + 1;
+        m_iv.push_back(iovec{m_file_address + m_range_first[0], len});
+        return len;
+    }
+    // 分段头先全部写进m_body，生成完之后再取地址，避免string扩容使指针失效
+    size_t offsets[MAX_RANGES + 1];
+    string type = GetFileType_();
+    char line[160];
+    m_body.clear();
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        offsets[i] = m_body.size();
+        snprintf(line, sizeof(line), "\r\n--TWS%s\r\nContent-Type:%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n",
+                 m_etag, type.c_str(), (long long)m_range_first[i], (long long)m_range_last[i], (long long)m_file_len);
+        m_body += line;
+    }
+    offsets[m_range_count] = m_body.size();
+    m_body += "\r\n--TWS";
+    m_body += m_etag;
+    m_body += "--\r\n";
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        m_iv.push_back(iovec{&m_body[offsets[i]], offsets[i + 1] - offsets[i]});
+        m_iv.push_back(iovec{m_file_address + m_range_first[i], (size_t)(m_range_last[i] - m_range_first[i] + 1)});
+    }
+    m_iv.push_back(iovec{&m_body[offsets[m_range_count]], m_body.size() - offsets[m_range_count]});
+    off_t len = 0;
+    for (size_t i = 1; i < m_iv.size(); ++i)
+        len += m_iv[i].iov_len;
+    return len;
+}
+// 按br、gzip的顺序找客户端接受的编码，先找预压缩的兄弟文件，再找压缩缓存
+bool http_conn::open_encoded()
+{
+    static const int ORDER[] = {ENC_BR, ENC_GZIP};
+    for (int enc : ORDER)
+    {
+        if (!(m_accept_enc & enc))
+            continue;
+        char file[FILENAME_LEN + 4];
+        snprintf(file, sizeof(file), "%s%s", m_real_file, compress_cache::suffix(enc));
+        struct stat st;
+        // 比原文件旧的预压缩文件说明原文件改过，不能再用
+        if (stat(file, &st) < 0 || !S_ISREG(st.st_mode) || 0 == st.st_size || st.st_mtime < m_file_stat.st_mtime)
+            continue;
+        int fd = open(file, O_RDONLY);
+        if (fd < 0)
+            continue;
+        void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == addr)
+            continue;
+        m_file_address = (char *)addr;
+        m_file_len = st.st_size;
+        m_content_enc = enc;
+        metrics::get_instance()->count(METRIC_COMPRESS_HIT);
+        return true;
+    }
+    compress_cache *cache = compress_cache::get_instance();
+    if (!cache->enabled())
+        return false;
+    for (int enc : ORDER)
+    {
+        if (!(m_accept_enc & enc))
+            continue;
+        m_encoded = cache->get(m_real_file, m_file_stat, enc);
+        if (m_encoded)
+        {
+            // 响应体在缓存里，发完只释放引用，不做munmap
+            m_body_dynamic = true;
+            m_file_address = (char *)m_encoded->data();
+            m_file_len = m_encoded->size();
+            m_content_enc = enc;
+            return true;
+        }
+    }
+    return false;
+}
 // 对内存映射区执行munmap操作
 void http_conn::unmap()
 {
     if (m_file_address)
     {
-        munmap(m_file_address, m_file_stat.st_size);
+        if (!m_body_dynamic)
+            munmap(m_file_address, m_file_len);
         m_file_address = 0;
     }
+    m_encoded.reset();
+    m_stream.reset();
 }
 // 非阻塞的写
 // 写HTTP响应
@@ -969,15 +1325,16 @@ bool http_conn::write()
     if (bytes_to_send == 0)
     {
         // 将要发送的字节为0，这一次响应结束
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        rearm(EPOLLIN);
         init();
         return true;
     }
 
+    m_trace.begin(TRACE_WRITE_START);
     while (1)
     {
         // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = writev(m_sockfd, &m_iv[m_iv_idx], m_iv.size() - m_iv_idx);
 
         if (temp < 0)
         {
@@ -985,44 +1342,151 @@ bool http_conn::write()
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if (errno == EAGAIN)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                rearm(EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
-        // 已经发送的字节 + temp
-        bytes_have_send += temp;
-        // 将要发送的字节 - temp
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
-        {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
-        // 没有数据要发送了
-        if (bytes_to_send <= 0)
+        // 没有数据要发送了，流式响应接着生成下一批
+        if (advance(temp) && !refill())
+            return write_done();
+    }
+}
+void http_conn::rearm(int ev)
+{
+    if (m_armed == ev)
+        return;
+    // 先记下再注册，事件可能在epoll_ctl返回前就被主线程收到并调用fired
+    m_armed = ev;
+    modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
+}
+bool http_conn::write_now()
+{
+    m_trace.begin(TRACE_WRITE_START);
+    do
+    {
+        while (bytes_to_send > 0)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
+            int n = writev(m_sockfd, &m_iv[m_iv_idx], m_iv.size() - m_iv_idx);
+            // 发不出去的部分由主线程在EPOLLOUT时继续发，出错也交给主线程的write处理
+            if (n < 0)
                 return false;
-            }
+            advance(n);
         }
+    } while (refill());
+    return true;
+}
+bool http_conn::advance(int n)
+{
+    // 已经发送的字节 + n
+    bytes_have_send += n;
+    // 将要发送的字节 - n
+    bytes_to_send -= n;
+    // 跳过已经整段发完的i/o向量，没发完的那段从已发出的位置继续
+    while (m_iv_idx < m_iv.size() && (size_t)n >= m_iv[m_iv_idx].iov_len)
+        n -= m_iv[m_iv_idx++].iov_len;
+    if (m_iv_idx < m_iv.size())
+    {
+        m_iv[m_iv_idx].iov_base = (char *)m_iv[m_iv_idx].iov_base + n;
+        m_iv[m_iv_idx].iov_len -= n;
+    }
+    return bytes_to_send <= 0;
+}
+void http_conn::push_iov(const void *base, size_t len)
+{
+    if (0 == len)
+        return;
+    m_iv.push_back(iovec{(void *)base, len});
+    bytes_to_send += len;
+}
+bool http_conn::refill()
+{
+    if (!m_stream || m_stream_last)
+        return false;
+    // 上一批的数据都已发出，它的缓冲区可以复用
+    m_chunk.reset();
+    m_stream_last = !m_stream->produce(m_chunk) || 0 == m_chunk.size();
+    if (m_stream->failed())
+    {
+        // 响应体不完整，关掉socket让客户端知道；调用者按短连接收尾，主线程读到EOF后关闭
+        LOG_ERROR("stream of %s failed after %lld bytes", m_url, (long long)bytes_have_send);
+        m_linger = false;
+        shutdown(m_sockfd, SHUT_RDWR);
+        return false;
+    }
+    // 第一批跟在响应头后面，之后每批从头开始
+    m_iv.erase(m_iv.begin(), m_iv.begin() + m_iv_idx);
+    m_iv_idx = 0;
+    bytes_to_send += m_chunk.finish(m_stream->chunked(), m_stream_last, m_iv);
+    return true;
+}
+bool http_conn::write_done()
+{
+    // 协程发出的一段写完了，由主线程交回线程池接着执行，期间不注册事件
+    if (m_coro)
+    {
+        coro_scheduler::get_instance()->ready(this);
+        return true;
+    }
+    response_done();
+    unmap();
+
+    if (m_linger)
+    {
+        // 读缓冲区里还有管线化的后续请求时不重新注册EPOLLIN，由调用者直接交给process
+        if (!keep_pipelined())
+            rearm(EPOLLIN);
+        return true;
+    }
+    // 调用者会关闭连接，不需要再注册事件
+    return false;
+}
+void http_conn::recv_done(int n)
+{
+    if (0 == m_req_start_ns)
+        m_req_start_ns = metrics::now_ns();
+    m_read_idx += n;
+}
+int http_conn::send_iov(const struct iovec **iov)
+{
+    if (bytes_to_send <= 0)
+        return 0;
+    // 一条链最多MAX_SEND_IOV段，剩下的等这一条发完再取
+    *iov = &m_iv[m_iv_idx];
+    return min(m_iv.size() - m_iv_idx, (size_t)MAX_SEND_IOV);
+}
+bool http_conn::send_done(int n)
+{
+    if (n < 0)
+    {
+        unmap();
+        return false;
     }
+    if (advance(n) && !refill())
+        return write_done();
+    return true;
+}
+// 保留当前请求之后已经读到的字节，重置连接状态后放回读缓冲区开头
+bool http_conn::keep_pipelined()
+{
+    int end = m_checked_idx;
+    if (m_check_state == CHECK_STATE_CONTENT)
+        end += m_content_length;
+    int left = m_read_idx - end;
+    if (left <= 0)
+    {
+        init();
+        return false;
+    }
+    char rest[READ_BUFFER_SIZE];
+    memcpy(rest, m_read_buf + end, left);
+    init();
+    memcpy(m_read_buf, rest, left);
+    m_read_idx = left;
+    m_req_start_ns = metrics::now_ns();
+    m_pipelined = true;
+    return true;
 }
 // 往写缓冲中写入待发送的数据
 bool http_conn::add_response(const char *format, ...)
@@ -1051,18 +1515,22 @@ bool http_conn::add_response(const char *format, ...)
 // 添加响应行
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 // 添加响应头
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(off_t content_len)
 {
-    return add_content_length(content_len) && add_content_type() && add_linger() &&
-           add_blank_line();
+    return add_content_length(content_len) && add_content_type() && add_content_range() && add_encoding() &&
+           add_validators() && add_extra_headers() && add_date() && add_linger() && add_blank_line();
 }
 // 添加响应体长度
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    // 长度事先未知的流式响应用分块编码
+    if (content_len < 0)
+        return add_response("Transfer-Encoding:chunked\r\n");
+    return add_response("Content-Length:%lld\r\n", (long long)content_len);
 }
 
 string http_conn::GetFileType_() {
@@ -1083,13 +1551,79 @@ string http_conn::GetFileType_() {
 // 添加响应体类型
 bool http_conn::add_content_type()
 {
+    if (m_body_type)
+        return add_response("Content-Type:%s\r\n", m_body_type);
+    // 多个区间的各段类型写在分段头里
+    if (m_range_count > 1)
+        return add_response("Content-Type:multipart/byteranges; boundary=TWS%s\r\n", m_etag);
     return add_response("Content-Type:%s\r\n", GetFileType_().c_str());
 }
+// 压缩的响应体加Content-Encoding，可以协商编码的类型都加Vary，让中间缓存按Accept-Encoding区分
+bool http_conn::add_encoding()
+{
+    if (m_content_enc && !add_response("Content-Encoding:%s\r\n", compress_cache::name(m_content_enc)))
+        return false;
+    return !m_vary || add_response("Vary:Accept-Encoding\r\n");
+}
+bool http_conn::add_validators()
+{
+    if (m_etag[0])
+    {
+        // 压缩后的字节与原文件不同，强ETag要区分编码
+        const char *suffix = m_content_enc ? compress_cache::suffix(m_content_enc) + 1 : "";
+        char date[32];
+        struct tm tm;
+        gmtime_r(&m_file_stat.st_mtime, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (!add_response("ETag:\"%s%s%s\"\r\nLast-Modified:%s\r\n", m_etag, *suffix ? "-" : "", suffix, date))
+            return false;
+        // 只有未压缩的版本支持区间请求
+        if (!m_content_enc && !add_response("Accept-Ranges:bytes\r\n"))
+            return false;
+    }
+    return !m_cache_control || add_response("Cache-Control:%s\r\n", m_cache_control);
+}
+bool http_conn::add_content_range()
+{
+    if (416 == m_status)
+        return add_response("Content-Range:bytes */%lld\r\n", (long long)m_file_len);
+    if (1 == m_range_count)
+        return add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)m_range_first[0],
+                            (long long)m_range_last[0], (long long)m_file_len);
+    return true;
+}
+bool http_conn::add_extra_headers()
+{
+    return m_response.headers().empty() || add_response("%s", m_response.headers().c_str());
+}
+bool http_conn::add_date()
+{
+    char date[32];
+    time_cache::get_instance()->http_date(date);
+    return add_response("Date:%s\r\n", date);
+}
 // 长连接
 bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+void http_conn::response_done()
+{
+    int64_t now = metrics::now_ns();
+    int64_t latency = m_req_start_ns ? now - m_req_start_ns : 0;
+    metrics *m = metrics::get_instance();
+    m->count_status(m_status);
+    m->count(METRIC_BYTES_SENT, bytes_have_send);
+    m->observe(METRIC_WRITE, now - m_write_start_ns);
+    m->observe(METRIC_REQUEST, latency);
+
+    m_trace.end(TRACE_WRITE_END);
+    tracer::get_instance()->finish(m_trace.rec, m_sockfd, m_url, m_status);
+
+    access_log *log = access_log::get_instance();
+    if (log->enabled())
+        log->append(m_address.sin_addr.s_addr, m_method, m_url, m_status, bytes_have_send, latency);
+}
 // 添加空行
 bool http_conn::add_blank_line()
 {
@@ -1142,19 +1676,114 @@ bool http_conn::process_write(HTTP_CODE ret)
                 return false;
             break;
         }
+        // 区间都落在文件之外
+        case RANGE_NOT_SATISFIABLE:
+        {
+            add_status_line(416, error_416_title);
+            add_headers(strlen(error_416_form));
+            if (!add_content(error_416_form))
+                return false;
+            break;
+        }
+        // 过载，告诉客户端稍后重试
+        case SERVICE_UNAVAILABLE:
+        {
+            add_status_line(503, status_title(503));
+            add_response("Retry-After:%d\r\n", admission::RETRY_AFTER);
+            add_headers(strlen(admission::busy_form));
+            if (!add_content(admission::busy_form))
+                return false;
+            break;
+        }
+        // 同一IP请求太快
+        case TOO_MANY_REQUESTS:
+        {
+            add_status_line(429, status_title(429));
+            add_response("Retry-After:%d\r\n", m_retry_after);
+            add_headers(strlen(error_429_form));
+            if (!add_content(error_429_form))
+                return false;
+            break;
+        }
+        // 客户端缓存的版本仍然有效，只回响应头，不带响应体也不带Content-Length
+        case NOT_MODIFIED:
+        {
+            add_status_line(304, not_modified_304_title);
+            if (!add_validators() || (m_vary && !add_response("Vary:Accept-Encoding\r\n")) || !add_date() ||
+                !add_linger() || !add_blank_line())
+                return false;
+            break;
+        }
+        // 生成的响应体在m_body中，借用文件响应的发送路径
+        case DYNAMIC_REQUEST:
+        {
+            add_status_line(m_response.status(), status_title(m_response.status()));
+            add_headers(m_body.size());
+            m_body_dynamic = true;
+            m_file_address = &m_body[0];
+            push_iov(m_write_buf, m_write_idx);
+            push_iov(m_file_address, m_body.size());
+            return true;
+        }
+        // 长度未知，响应头之后先带上第一批，其余的在发送时边发边生成
+        case STREAM_REQUEST:
+        {
+            add_status_line(m_response.status(), status_title(m_response.status()));
+            add_headers(-1);
+            push_iov(m_write_buf, m_write_idx);
+            refill();
+            return true;
+        }
+        // 协程把响应体里已有的内容先发出去，第一段带上响应头；协程结束时再加上结束块
+        case CORO_REQUEST:
+        {
+            m_iv.clear();
+            m_iv_idx = 0;
+            if (!m_coro_flushed)
+            {
+                m_body_type = m_response.type();
+                add_status_line(m_response.status(), status_title(m_response.status()));
+                add_headers(-1);
+                push_iov(m_write_buf, m_write_idx);
+                m_coro_flushed = true;
+            }
+            m_chunk.reset();
+            m_chunk.write_ref(m_body.data(), m_body.size());
+            bytes_to_send += m_chunk.finish(true, !m_coro, m_iv);
+            return true;
+        }
         // 文件请求，请求成功
         case FILE_REQUEST:
         {
-            add_status_line(200, ok_200_title);
-            if (m_file_stat.st_size != 0)
+            // 按窗口发送的大文件，响应头之后先带上第一个窗口
+            if (m_stream)
             {
-                add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buf;
+                if (m_range_count > 0)
+                    add_status_line(206, partial_206_title);
+                else
+                    add_status_line(200, ok_200_title);
+                add_headers(m_range_count ? m_range_last[0] - m_range_first[0] + 1 : m_file_len);
+                push_iov(m_write_buf, m_write_idx);
+                refill();
+                return true;
+            }
+            // 区间请求只发送请求的片段，数据仍然直接取自映射区
+            if (m_range_count > 0)
+            {
+                m_iv.push_back(iovec{m_write_buf, 0});
+                off_t len = fill_ranges();
+                add_status_line(206, partial_206_title);
+                add_headers(len);
                 m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
+                bytes_to_send = m_write_idx + len;
+                return true;
+            }
+            add_status_line(200, ok_200_title);
+            if (m_file_len != 0)
+            {
+                add_headers(m_file_len);
+                push_iov(m_write_buf, m_write_idx);
+                push_iov(m_file_address, m_file_len);
                 return true;
             }
             else
@@ -1168,10 +1797,7 @@ bool http_conn::process_write(HTTP_CODE ret)
         default:
             return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    push_iov(m_write_buf, m_write_idx);
     return true;
 }
 
@@ -1179,18 +1805,73 @@ bool http_conn::process_write(HTTP_CODE ret)
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process()
 {
-    // 解析HTTP请求
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST)
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        return;
-    }
-    // 生成响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    // 准入控制的决定只对这次取出时要开始处理的新请求有效
+    bool shed = m_shed && !m_coro;
+    m_shed = false;
+    // 乐观写发完后读缓冲区里还有管线化的请求、或者协程发出的一段已经写完时继续处理
+    do
     {
-        close_conn();
-    }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+        HTTP_CODE read_ret;
+        if (m_coro)
+        {
+            // 协程等的事件到了，从挂起的地方继续
+            read_ret = resume_coro();
+        }
+        else if (shed)
+        {
+            // 准入控制拒绝的请求不解析，读缓冲区里剩下的内容随连接一起丢弃
+            shed = false;
+            m_linger = false;
+            admission::get_instance()->shed(SHED_QUEUE);
+            read_ret = SERVICE_UNAVAILABLE;
+        }
+        else
+        {
+            // 解析HTTP请求
+            int64_t parse_start = metrics::now_ns();
+            m_trace.begin(TRACE_PARSE_START);
+            read_ret = process_read();
+            m_trace.end(TRACE_PARSE_END);
+            if (read_ret == NO_REQUEST)
+            {
+                rearm(EPOLLIN);
+                return;
+            }
+            metrics::get_instance()->observe(METRIC_PARSE, metrics::now_ns() - parse_start);
+        }
+        // 等定时器或阻塞任务时交给调度器，这之后连接归调度器，不能再访问
+        if (m_coro && m_coro.promise().wait != CORO_FLUSH)
+        {
+            coro_scheduler::get_instance()->park(m_coro);
+            return;
+        }
+        m_write_start_ns = metrics::now_ns();
+        // 生成响应
+        bool write_ret = process_write(read_ret);
+        if (!write_ret)
+        {
+            close_conn();
+            return;
+        }
+        // 协程发出的一段是空的，不用等写完
+        if (m_coro && 0 == bytes_to_send)
+            continue;
+        // 长连接的响应直接在工作线程发送，发完只需要重新注册一次EPOLLIN，
+        // 省去注册EPOLLOUT、等主线程唤醒再发送的一次epoll_ctl和一次epoll_wait。
+        // 短连接发完要由主线程关闭并删除定时器，io_uring后端由内核发送，仍然走EPOLLOUT
+        if (!m_linger || uring::get_instance()->enabled() || !write_now())
+        {
+            rearm(EPOLLOUT);
+            return;
+        }
+        // 协程发出的一段写完了，接着执行
+        if (m_coro)
+            continue;
+        // 流式响应中途出错时socket已经关闭，等主线程读到EOF后收尾
+        if (!write_done())
+        {
+            rearm(EPOLLIN);
+            return;
+        }
+    } while (m_pipelined || m_coro);
 }
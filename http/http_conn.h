@@ -21,23 +21,44 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <vector>
 #include<unordered_map>
 #include<unordered_set>
 #include<regex>
 #include<string>
+#include <atomic>
 
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../auth/credential_store.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "../timer/time_cache.h"
+#include "../net/uring.h"
+#include "compress_cache.h"
+#include "stream.h"
+#include "router.h"
+#include "handler.h"
+#include "rate_limit.h"
 
 using namespace std;
+
+// 从epoll中删除并关闭fd，io_uring后端下同时丢弃该连接之后到达的完成事件
+void removefd(int epollfd, int fd);
+
 class http_conn
 {
+    // 性能测试直接驱动私有的解析函数
+    friend struct parser_bench;
+
 public:
     static const int FILENAME_LEN = 200;        // 文件名的最大长度
     static const int READ_BUFFER_SIZE = 2048;   // 读缓冲区的大小
     static const int WRITE_BUFFER_SIZE = 1024;  // 写缓冲区的大小
+    static const int MAX_RANGES = 8;            // 一个请求最多的Range区间，超过时发送整个文件
+    static const int MAX_SEND_IOV = 16;         // io_uring后端一次提交的发送段数
     // HTTP请求方法，但我们只支持GET
     enum METHOD
     {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT, PATH};
@@ -59,7 +80,12 @@ public:
         FORBIDDEN_REQUEST: 表示客户对资源没有足够的访问权限
         FILE_REQUEST: 文件请求，获取文件成功
         INTERNAL_ERROR: 表示服务器内部错误
-        CLOSED_CONNECTION: 表示客户端已经关闭连接*/
+        CLOSED_CONNECTION: 表示客户端已经关闭连接
+        DYNAMIC_REQUEST: 请求保留路径，响应体已生成
+        NOT_MODIFIED: 客户端缓存的版本仍然有效，回304
+        RANGE_NOT_SATISFIABLE: Range里没有落在文件内的区间，回416
+        STREAM_REQUEST: 响应体由m_stream边发边生成，用分块编码
+        CORO_REQUEST: 协程处理函数挂起了，或者要把已经生成的部分先发出去*/
     enum HTTP_CODE
     {
         NO_REQUEST,
@@ -69,7 +95,14 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        DYNAMIC_REQUEST,
+        NOT_MODIFIED,
+        RANGE_NOT_SATISFIABLE,
+        STREAM_REQUEST,
+        CORO_REQUEST,
+        SERVICE_UNAVAILABLE,
+        TOO_MANY_REQUESTS
     };
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
@@ -85,7 +118,7 @@ public:
     ~http_conn() {}
 
 public:
-    // 初始化新接收的连接
+    // 初始化新接收的连接，sockfd需要已经是非阻塞的
     void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
     // 关闭连接
     void close_conn(bool real_close = true);
@@ -95,17 +128,45 @@ public:
     bool read_once();
     // 非阻塞的写
     bool write();
+    // 以下供io_uring后端使用，接收和发送由内核完成，这里只做记账
+    // 读缓冲区剩余的空间
+    char *recv_buf(int &len)
+    {
+        len = READ_BUFFER_SIZE - m_read_idx;
+        return m_read_buf + m_read_idx;
+    }
+    // 接收了n字节
+    void recv_done(int n);
+    // 还没发送的数据，iov指向内部的i/o向量，返回段数，最多MAX_SEND_IOV段，没有要发送的数据时返回0
+    int send_iov(const struct iovec **iov);
+    // 发出了n字节，n<0表示出错；返回值同write
+    bool send_done(int n);
+    // 响应发完后读缓冲区里还有管线化的请求，需要再调用一次process
+    bool pipelined() const
+    {
+        return m_pipelined;
+    }
+    // 主线程收到该连接的事件后调用，EPOLLONESHOT已经摘掉了注册的事件
+    void fired()
+    {
+        m_armed = 0;
+    }
+    // 路由表，第一次调用时建好，服务器开始监听前先调用一次
+    static const router &routes();
+    // 注册动态接口，methods为ROUTE_GET/ROUTE_POST按位或，prefix表示path之下的路径都交给它；
+    // 要在路由表建好之前调用，之后再注册返回false
+    static bool add_handler(int methods, const char *path, const request_handler &fn, bool prefix = false);
+    // 注册协程处理函数，参数同add_handler
+    static bool add_coro_handler(int methods, const char *path, const coro_handler &fn, bool prefix = false);
     // 获取客户端地址
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    // 初始化数据库连接
-    void initmysql_result(connection_pool *connPool);
     // 定时器标记
     int timer_flag;
-    // 
-    int improv;
+    // reactor下工作线程处理完的标记，主线程忙等它；必须在timer_flag之后置位
+    std::atomic<int> improv;
 
 
 private:
@@ -126,6 +187,29 @@ private:
     HTTP_CODE parse_content(char *text);
     // 对请求进行响应
     HTTP_CODE do_request();
+    // 路由表里的处理函数，返回GET_REQUEST表示接着发送file指向的页面，其余值直接作为响应
+    typedef HTTP_CODE (http_conn::*route_handler)(const char *&file);
+    static const route_handler HANDLERS[];
+    HTTP_CODE handle_metrics(const char *&file);
+    HTTP_CODE handle_traces(const char *&file);
+    HTTP_CODE handle_login(const char *&file);
+    HTTP_CODE handle_register(const char *&file);
+    // 调用注册的动态接口，path_len为不含查询串的路径长度
+    HTTP_CODE call_handler(const request_handler &fn, size_t path_len);
+    // 创建协程并开始执行
+    HTTP_CODE call_coro(const coro_handler &fn, size_t path_len);
+    // 从挂起的地方继续执行协程，挂起或者要发出一段时返回CORO_REQUEST
+    HTTP_CODE resume_coro();
+    // 动态接口看到的请求，指向读缓冲区
+    void fill_view(size_t path_len);
+    // 按Accept-Encoding准备压缩的响应体，找不到可用的编码时返回false
+    bool open_encoded();
+    // 按If-None-Match/If-Modified-Since判断客户端缓存的版本是否仍然有效
+    bool not_modified();
+    // 解析Range，返回区间数；0表示按整个文件响应，-1表示没有可满足的区间
+    int parse_range();
+    // 按区间填充响应头之后的i/o向量，多个区间时生成multipart/byteranges的分段头，返回响应体长度
+    off_t fill_ranges();
     // 读取一行
     char *get_line() { return m_read_buf + m_start_line; };
     // 解析请求行
@@ -139,29 +223,66 @@ private:
     bool add_content(const char *content);
     // 添加状态行
     bool add_status_line(int status, const char *title);
-    // 添加响应头
-    bool add_headers(int content_length);
+    // 添加响应头，content_length小于0时用分块编码
+    bool add_headers(off_t content_length);
     // 添加响应体类型
     bool add_content_type();
     // 添加响应体长度
-    bool add_content_length(int content_length);
+    bool add_content_length(off_t content_length);
     // 添加HTTP响应是否保持连接
     bool add_linger();
+    // 添加Content-Encoding和Vary头
+    bool add_encoding();
+    // 添加ETag、Last-Modified和Cache-Control头，只有文件响应才有
+    bool add_validators();
+    // 添加206和416响应的Content-Range头
+    bool add_content_range();
+    // 添加Date头，取自按秒缓存的时间字符串
+    bool add_date();
+    // 添加动态接口设置的额外响应头
+    bool add_extra_headers();
     // 添加空行
     bool add_blank_line();
+    // 重新注册EPOLLONESHOT事件，与已注册的相同时跳过
+    void rearm(int ev);
+    // 工作线程生成响应后直接发送，发完返回true，EAGAIN或出错时返回false
+    bool write_now();
+    // 发出n字节后调整i/o向量，全部发完返回true
+    bool advance(int n);
+    // 往i/o向量末尾追加一段
+    void push_iov(const void *base, size_t len);
+    // 流式响应的上一批发完后生成下一批，没有更多输出时返回false
+    bool refill();
+    // 响应全部发完后的收尾，返回false表示要关闭连接
+    bool write_done();
+    // 响应发送完后记录运行指标和访问日志
+    void response_done();
+    // 长连接上保留已读到的后续请求，有则返回true
+    bool keep_pipelined();
 
     string GetFileType_();
     // 响应体类型
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+    // 按路径前缀选择Cache-Control，取最长的匹配
+    static const std::vector<std::pair<std::string, std::string>> CACHE_CONTROL;
 
 public:
     // 所有的socket上的事件都被注册到同一个epoll对象中
     static int m_epollfd;
-    // 统计用户的数量
-    static int m_user_count;
-    // 数据库连接对象
-    MYSQL *mysql;           
-    int m_state;  //读为0, 写为1
+    // 统计用户的数量，主线程和工作线程都会修改
+    static std::atomic<int> m_user_count;
+    // 登录和注册使用的凭据存储，所有连接共用
+    static credential_store *m_credentials;
+    // 请求的路径是目录时是否生成目录列表
+    static bool m_autoindex;
+    // 不小于这个大小的文件按窗口读取发送，不整体mmap；0表示总是mmap
+    static off_t m_large_file;
+    int m_state;  //读为0, 写为1, 继续执行协程为2
+    // 进入线程池请求队列的时间，以及准入控制是否拒绝这次取出的新请求
+    int64_t m_queued_ns;
+    bool m_shed;
+    // 分阶段追踪记录，主线程和工作线程在各自负责的阶段打点
+    request_trace m_trace;
 
 private:
     // 该HTTP连接的socket
@@ -200,25 +321,78 @@ private:
     char *m_file_address;
     // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     struct stat m_file_stat;
+    // m_file_address处响应体的长度，发送压缩版本时与m_file_stat.st_size不同
+    off_t m_file_len;
+    // 客户端接受的压缩编码，CONTENT_ENCODING按位或
+    int m_accept_enc;
+    // 响应体使用的编码
+    int m_content_enc;
+    // 响应随Accept-Encoding变化，需要带Vary头
+    bool m_vary;
+    // 响应体来自压缩缓存时持有它，发送期间缓存淘汰也不会释放
+    std::shared_ptr<const std::string> m_encoded;
+    // 由inode、大小和修改时间生成的强ETag，不含引号和编码后缀，空表示不是文件响应
+    char m_etag[64];
+    // 按路径前缀匹配到的Cache-Control，NULL表示不发送
+    const char *m_cache_control;
+    // 请求头If-None-Match和If-Modified-Since的值，指向读缓冲区
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    // 请求头Range和If-Range的值，指向读缓冲区
+    char *m_range;
+    char *m_if_range;
+    // 要发送的区间，闭区间[m_range_first, m_range_last]，m_range_count为0时发送整个文件
+    int m_range_count;
+    off_t m_range_first[MAX_RANGES];
+    off_t m_range_last[MAX_RANGES];
     // 我们将采用writev来执行写操作，所以定义下面两个成员。
-    // i/o 向量
-    struct iovec m_iv[2];
-    // m_iv_count表示被写内存块的数量
-    int m_iv_count;
+    // i/o 向量，长度不限，clear后保留容量给同一连接的下一个响应
+    std::vector<struct iovec> m_iv;
+    // 第一个还没发完的内存块
+    size_t m_iv_idx;
+    // 流式响应的生产者和它当前这一批的输出
+    std::unique_ptr<stream_source> m_stream;
+    chunk_writer m_chunk;
+    // 生产者已经结束，当前这一批带着结束块
+    bool m_stream_last;
     int cgi;        //是否启用的POST
     char *m_string; //存储请求头数据
     // 将要发送的数据的字节数
-    int bytes_to_send;
+    int64_t bytes_to_send;
     // 已经发送的字节数
-    int bytes_have_send;
+    int64_t bytes_have_send;
     // 网站根目录
     char *doc_root;
     // 用户映射
     map<string, string> m_users;
     // 连接的触发模式
     int m_TRIGMode;
+    // 当前在epoll中注册的事件，0表示已经触发、需要重新注册
+    int m_armed;
     // 日志写入方式
     int m_close_log;
+    // 收到当前请求第一个字节的时刻，CLOCK_MONOTONIC纳秒，0表示还没收到
+    int64_t m_req_start_ns;
+    // 响应生成完的时刻，用于统计发送耗时
+    int64_t m_write_start_ns;
+    // 当前响应的状态码
+    int m_status;
+    // 响应体不是mmap的文件，而是m_body中生成的内容
+    bool m_body_dynamic;
+    string m_body;
+    // 生成的响应体的类型，为NULL时按文件后缀判断
+    const char *m_body_type;
+    // 动态接口填写的状态码、类型和额外的头，生成的响应体也在m_body中
+    response_builder m_response;
+    request_view m_view;
+    // 挂起中的协程处理函数，等的事件到了由工作线程继续执行
+    coro_task m_coro;
+    // 协程已经发出了响应头，之后的响应体用分块编码
+    bool m_coro_flushed;
+    // 超过限速时告诉客户端多少秒后重试
+    int m_retry_after;
+    // 读缓冲区中是已经读到的管线化请求
+    bool m_pipelined;
     // 数据库用户名
     char sql_user[100];
     // 数据库密码
@@ -231,7 +405,6 @@ private:
     void ParseHeader_(const std::string& line);
     void ParseBody_(const std::string& line);
 
-    void ParsePath_();
     void ParsePost_();
     void ParseFromUrlencoded_();
 
@@ -242,8 +415,6 @@ private:
     std::unordered_map<std::string, std::string> header_;
     std::unordered_map<std::string, std::string> post_;
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
     static int ConverHex(char ch);
 };
 
@@ -0,0 +1,155 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sched.h>
+#include <time.h>
+#include "rate_limit.h"
+#include "handler.h"
+
+rate_limiter::~rate_limiter()
+{
+    delete[] m_table;
+}
+
+uint32_t rate_limiter::now_ms()
+{
+    // 令牌按经过的时间补充，粗粒度时钟的几毫秒误差不影响，读时钟不进内核
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+bool rate_limiter::add(int methods, const char *path, double rate, double burst, bool prefix)
+{
+    // 槽位里的规则编号只有一个字节
+    if (m_table || !path || path[0] != '/' || !(rate > 0) || m_rules.size() >= 255)
+        return false;
+    m_paths.push_back(path);
+    m_routes.push_back(route{m_paths.back().c_str(), methods, prefix, NULL, (int)m_rules.size()});
+    m_rules.push_back(rule{(float)(rate / 1000), (float)(burst >= 1 ? burst : 1)});
+    return true;
+}
+
+bool rate_limiter::parse(const char *spec)
+{
+    const char *p = spec;
+    while (p && *p)
+    {
+        const char *end = strchr(p, ',');
+        std::string item(p, end ? end - p : strlen(p));
+        p = end ? end + 1 : NULL;
+
+        int methods = ROUTE_GET | ROUTE_POST;
+        const char *s = item.c_str();
+        s += strspn(s, " ");
+        if (0 == strncasecmp(s, "GET ", 4))
+            methods = ROUTE_GET;
+        else if (0 == strncasecmp(s, "POST ", 5))
+            methods = ROUTE_POST;
+        if (methods != (ROUTE_GET | ROUTE_POST))
+            s = strchr(s, ' ') + strspn(strchr(s, ' '), " ");
+
+        const char *eq = strchr(s, '=');
+        if (!eq || eq == s)
+            return false;
+        std::string path(s, eq - s);
+        bool prefix = '*' == path.back();
+        if (prefix)
+            path.pop_back();
+        char *rest;
+        double rate = strtod(eq + 1, &rest);
+        double burst = rate;
+        if (':' == *rest)
+            burst = strtod(rest + 1, &rest);
+        if (*rest != '\0' || !add(methods, path.c_str(), rate, burst, prefix))
+            return false;
+    }
+    return true;
+}
+
+void rate_limiter::build(size_t groups)
+{
+    if (m_table || m_rules.empty())
+        return;
+    for (const route &r : m_routes)
+        m_router.add(r);
+    m_router.build();
+    m_groups = 1;
+    while (m_groups < groups)
+        m_groups <<= 1;
+    m_mask = m_groups - 1;
+    m_table = new group[m_groups]();
+}
+
+bool rate_limiter::allow(int method, const char *path, size_t len, uint32_t ip, int &retry_after)
+{
+    if (!m_table)
+        return true;
+    size_t matched = 0;
+    const route *r = m_router.match(method, path, len, matched);
+    return !r || allow(r->handler, ip, now_ms(), retry_after);
+}
+
+bool rate_limiter::allow(int idx, uint32_t ip, uint32_t now, int &retry_after)
+{
+    const rule &r = m_rules[idx];
+    uint8_t tag = (uint8_t)(idx + 1);
+    // 乘法哈希取高位，相邻的IP也分散到不同的组
+    uint64_t h = (((uint64_t)ip << 8) | tag) * 0x9E3779B97F4A7C15ULL;
+    group &g = m_table[(h >> 32) & m_mask];
+
+    // 临界区只有几十条指令，自旋等待；持有者被调度走时让出CPU
+    for (int spins = 0; g.lock.exchange(1, std::memory_order_acquire); ++spins)
+    {
+        if (spins >= 64)
+            sched_yield();
+#if defined(__x86_64__) || defined(__i386__)
+        else
+            __builtin_ia32_pause();
+#endif
+    }
+
+    // 找到自己的槽位；找不到时用空槽位，没有空的就替换最久没有请求的
+    int slot = -1, victim = 0;
+    uint32_t victim_age = 0;
+    for (int i = 0; i < GROUP_SLOTS; ++i)
+    {
+        if (g.rule[i] == tag && g.ip[i] == ip)
+        {
+            slot = i;
+            break;
+        }
+        uint32_t age = g.rule[i] ? now - g.stamp[i] : UINT32_MAX;
+        if (age > victim_age)
+        {
+            victim = i;
+            victim_age = age;
+        }
+    }
+    float tokens;
+    if (slot >= 0)
+    {
+        tokens = g.tokens[slot] + (float)(now - g.stamp[slot]) * r.rate;
+        if (tokens > r.burst)
+            tokens = r.burst;
+    }
+    else
+    {
+        slot = victim;
+        g.rule[slot] = tag;
+        g.ip[slot] = ip;
+        tokens = r.burst;
+    }
+    g.stamp[slot] = now;
+    bool ok = tokens >= 1;
+    g.tokens[slot] = ok ? tokens - 1 : tokens;
+    g.lock.store(0, std::memory_order_release);
+
+    if (!ok)
+    {
+        int wait = (int)ceilf((1 - tokens) / r.rate / 1000);
+        retry_after = wait > 0 ? wait : 1;
+    }
+    return ok;
+}
@@ -0,0 +1,88 @@
+/*************************************************************
+*按来源IP限速
+*每条限速规则按方法和路径匹配请求（精确路径或前缀，同路由表），每个IP在每条规则下有一个令牌桶。
+*令牌桶放在固定大小的开放寻址表里：IP和规则编号哈希到一个64字节的桶组，组内4个槽位线性查找，
+*一次检查只碰一条缓存行、一次无竞争的自旋锁。令牌不按时间补充，检查时按上次检查以来经过的时间一次算出。
+*组内放不下时替换最久没有请求的槽位，被替换的IP下次出现时按满桶重新开始；
+*表的大小固定，来源IP再多也不增加内存，只是不活跃的IP更早被替换
+**************************************************************/
+
+#ifndef HTTP_RATE_LIMIT_H
+#define HTTP_RATE_LIMIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
+#include "router.h"
+
+class rate_limiter
+{
+public:
+    static rate_limiter *get_instance()
+    {
+        static rate_limiter instance;
+        return &instance;
+    }
+
+    // 建表之前加入规则：methods同router，rate是每秒补充的令牌数，burst是桶的容量，不小于1。
+    // 同一路径有多条时按加入的顺序取第一条方法匹配的，精确路径优先于前缀
+    bool add(int methods, const char *path, double rate, double burst, bool prefix = false);
+    // 解析命令行的规则列表，逗号分隔，每条为"[GET |POST ]路径[*]=每秒令牌数[:容量]"，
+    // 路径以*结尾表示前缀，没有方法时匹配GET和POST，例如"POST /login=5:10,/=100:200"
+    bool parse(const char *spec);
+    // 加完规则后调用一次，groups是桶组数，向上取2的幂；没有规则时不分配表
+    void build(size_t groups = DEFAULT_GROUPS);
+    bool enabled() const { return m_groups != 0; }
+
+    // 请求是否放行，不放行时retry_after为拿到下一个令牌要等的秒数
+    bool allow(int method, const char *path, size_t len, uint32_t ip, int &retry_after);
+    // 直接按规则编号检查，now是now_ms()的返回值
+    bool allow(int idx, uint32_t ip, uint32_t now, int &retry_after);
+
+    size_t rules() const { return m_rules.size(); }
+    size_t slots() const { return m_groups * GROUP_SLOTS; }
+
+    // 默认65536组，共4MB，26万个槽位
+    static const size_t DEFAULT_GROUPS = 1 << 16;
+    static const int GROUP_SLOTS = 4;
+
+    static uint32_t now_ms();
+
+private:
+    rate_limiter() : m_groups(0), m_mask(0), m_table(NULL) {}
+    ~rate_limiter();
+
+    struct rule
+    {
+        float rate;  // 每毫秒补充的令牌数
+        float burst; // 桶的容量
+    };
+
+    // 一个桶组正好一条缓存行，锁和4个槽位放在一起
+    struct alignas(64) group
+    {
+        std::atomic<uint32_t> lock;
+        // 规则编号加1，0表示空槽位
+        uint8_t rule[GROUP_SLOTS];
+        uint32_t ip[GROUP_SLOTS];
+        // 上次检查的时间，毫秒，按无符号差值计算，回绕不影响
+        uint32_t stamp[GROUP_SLOTS];
+        float tokens[GROUP_SLOTS];
+        uint32_t pad[2];
+    };
+    static_assert(sizeof(group) == 64, "rate_limiter::group must fill one cache line");
+
+    std::vector<rule> m_rules;
+    std::vector<route> m_routes;
+    // 规则里的路径指向这里，list扩容时不移动元素
+    std::list<std::string> m_paths;
+    router m_router;
+    size_t m_groups;
+    size_t m_mask;
+    group *m_table;
+};
+
+#endif
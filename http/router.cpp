@@ -0,0 +1,132 @@
+#include <string.h>
+#include <map>
+#include <memory>
+#include <queue>
+#include "router.h"
+
+void router::add(const route &r)
+{
+    m_routes.push_back(r);
+}
+
+// 建树用的逐字节前缀树，展开成数组后丢弃
+struct build_node
+{
+    std::map<unsigned char, std::unique_ptr<build_node>> kids;
+    int32_t exact = -1;
+    int32_t prefix = -1;
+};
+
+void router::build()
+{
+    m_next.assign(m_routes.size(), -1);
+    m_nodes.clear();
+    m_labels.clear();
+
+    build_node root;
+    // 同一节点上的多条路由按加入顺序串起来
+    std::vector<int32_t *> tails(m_routes.size());
+    for (size_t i = 0; i < m_routes.size(); ++i)
+    {
+        build_node *n = &root;
+        for (const unsigned char *p = (const unsigned char *)m_routes[i].path; *p; ++p)
+        {
+            std::unique_ptr<build_node> &kid = n->kids[*p];
+            if (!kid)
+                kid.reset(new build_node);
+            n = kid.get();
+        }
+        int32_t *head = m_routes[i].prefix ? &n->prefix : &n->exact;
+        while (*head >= 0)
+            head = &m_next[*head];
+        *head = i;
+    }
+
+    // 按层展开：一个节点的子节点一起放进数组，只有一个子节点且没有路由的节点并进边里
+    std::queue<std::pair<const build_node *, uint32_t>> pending;
+    m_nodes.push_back(node{0, 0, 0, 0, root.exact, root.prefix});
+    pending.push(std::make_pair(&root, 0));
+    while (!pending.empty())
+    {
+        const build_node *src = pending.front().first;
+        uint32_t idx = pending.front().second;
+        pending.pop();
+        m_nodes[idx].first_child = m_nodes.size();
+        m_nodes[idx].child_count = src->kids.size();
+        // std::map按字节序遍历，子节点天然按首字节排好
+        for (const auto &kv : src->kids)
+        {
+            const build_node *n = kv.second.get();
+            uint32_t label = m_labels.size();
+            m_labels += (char)kv.first;
+            while (n->kids.size() == 1 && n->exact < 0 && n->prefix < 0)
+            {
+                m_labels += (char)n->kids.begin()->first;
+                n = n->kids.begin()->second.get();
+            }
+            pending.push(std::make_pair(n, (uint32_t)m_nodes.size()));
+            m_nodes.push_back(node{label, (uint32_t)(m_labels.size() - label), 0, 0, n->exact, n->prefix});
+        }
+    }
+}
+
+const route *router::pick(int32_t idx, int mask) const
+{
+    for (; idx >= 0; idx = m_next[idx])
+        if (m_routes[idx].methods & mask)
+            return &m_routes[idx];
+    return NULL;
+}
+
+const route *router::match(int method, const char *path, size_t len, size_t &matched) const
+{
+    if (m_nodes.empty())
+        return NULL;
+    int mask = 1 << method;
+    const route *best = NULL;
+    size_t best_len = 0;
+    const char *labels = m_labels.data();
+    const node *cur = &m_nodes[0];
+    size_t pos = 0;
+    while (true)
+    {
+        // 挂载点在节点上，走到这里说明前缀已经全部匹配
+        const route *r = pick(cur->prefix, mask);
+        if (r)
+        {
+            best = r;
+            best_len = pos;
+        }
+        if (pos == len)
+        {
+            r = pick(cur->exact, mask);
+            if (r)
+            {
+                matched = len;
+                return r;
+            }
+            break;
+        }
+        // 子节点按标签首字节有序，二分查找
+        unsigned char c = path[pos];
+        const node *first = m_nodes.data() + cur->first_child;
+        const node *end = first + cur->child_count;
+        const node *lo = first, *hi = end;
+        while (lo < hi)
+        {
+            const node *mid = lo + (hi - lo) / 2;
+            if ((unsigned char)labels[mid->label] < c)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == end || (unsigned char)labels[lo->label] != c)
+            break;
+        if (lo->label_len > len - pos || memcmp(labels + lo->label, path + pos, lo->label_len) != 0)
+            break;
+        pos += lo->label_len;
+        cur = lo;
+    }
+    matched = best_len;
+    return best;
+}
@@ -0,0 +1,69 @@
+/*************************************************************
+*路由表
+*启动时把路由表建成压缩前缀树（基数树）：边上的标签存在同一个字符串里，
+*节点按层展开成数组，同一节点的子节点连续存放、按标签首字节排序。
+*查找沿路径走一遍，每层二分查找子节点，耗时与路径长度成正比，不分配内存。
+*支持精确路由、前缀挂载（取最长的匹配）和处理函数
+**************************************************************/
+
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct route
+{
+    // 精确路由的完整路径，或挂载的前缀
+    const char *path;
+    // 允许的请求方法，按1 << http_conn::METHOD按位或
+    int methods;
+    // 前缀挂载：path之下的路径都匹配，有多个时取最长的
+    bool prefix;
+    // 精确路由为要发送的文件，挂载为替换前缀的目录，都相对网站根目录；NULL表示按请求路径。
+    // 挂载只替换匹配到的前缀，前缀以/结尾时目录也要以/结尾
+    const char *target;
+    // 处理函数的编号，由使用者解释，-1表示没有
+    int handler;
+};
+
+class router
+{
+public:
+    // 建树之前加入路由，字符串要在router的生命期内保持有效；
+    // 同一路径有多条时按加入的顺序取第一条方法匹配的
+    void add(const route &r);
+    // 加完路由后调用一次，之后只读，可以多线程并发查找
+    void build();
+    // path的前len个字节（不含查询串）；精确路由优先，其次最长的前缀挂载。
+    // 匹配到挂载时matched为前缀的长度，精确路由时为len
+    const route *match(int method, const char *path, size_t len, size_t &matched) const;
+
+    size_t size() const { return m_routes.size(); }
+    size_t nodes() const { return m_nodes.size(); }
+
+private:
+    struct node
+    {
+        // 从父节点到这里的边，m_labels中[label, label + label_len)
+        uint32_t label;
+        uint32_t label_len;
+        // 子节点在m_nodes中连续存放
+        uint32_t first_child;
+        uint32_t child_count;
+        // 落在这个节点上的精确路由和挂载，m_routes的下标，同一路径的多条用m_next串起来
+        int32_t exact;
+        int32_t prefix;
+    };
+
+    const route *pick(int32_t idx, int mask) const;
+
+    std::vector<route> m_routes;
+    std::vector<int32_t> m_next;
+    std::vector<node> m_nodes;
+    std::string m_labels;
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "stream.h"
+
+// 目录列表每批最多读这么多项，一批的HTML远小于STREAM_BATCH_BYTES
+static const int DIR_BATCH_ENTRIES = 128;
+// 池里最多留这么多空闲缓冲区，超出的直接释放
+static const size_t POOL_MAX_FREE = 64;
+
+void chunk_writer::write(const char *data, size_t len)
+{
+    if (0 == len)
+        return;
+    // 紧跟在上一段复制的数据后面时合并成一段
+    if (!m_segs.empty() && !m_segs.back().ref && m_segs.back().off + m_segs.back().len == m_buf.size())
+        m_segs.back().len += len;
+    else
+        m_segs.push_back(segment{NULL, m_buf.size(), len});
+    m_buf.append(data, len);
+    m_bytes += len;
+}
+
+void chunk_writer::printf(const char *format, ...)
+{
+    char line[512];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(line, sizeof(line), format, arg_list);
+    va_end(arg_list);
+    if (len < 0)
+        return;
+    if ((size_t)len < sizeof(line))
+    {
+        write(line, len);
+        return;
+    }
+    // 放不下时按实际长度再格式化一次
+    std::string big(len + 1, '\0');
+    va_start(arg_list, format);
+    vsnprintf(&big[0], big.size(), format, arg_list);
+    va_end(arg_list);
+    write(big.data(), len);
+}
+
+void chunk_writer::write_ref(const void *data, size_t len)
+{
+    if (0 == len)
+        return;
+    m_segs.push_back(segment{(const char *)data, 0, len});
+    m_bytes += len;
+}
+
+void chunk_writer::reset()
+{
+    m_buf.clear();
+    m_segs.clear();
+    m_bytes = 0;
+}
+
+size_t chunk_writer::finish(bool chunked, bool last, std::vector<struct iovec> &iv)
+{
+    static const char CRLF[] = "\r\n";
+    static const char LAST_CHUNK[] = "0\r\n\r\n";
+    static const char CRLF_LAST_CHUNK[] = "\r\n0\r\n\r\n";
+    size_t total = 0;
+    if (!chunked)
+    {
+        for (const segment &s : m_segs)
+            iv.push_back(iovec{(void *)(s.ref ? s.ref : &m_buf[s.off]), s.len});
+        return m_bytes;
+    }
+    if (m_bytes > 0)
+    {
+        int len = snprintf(m_head, sizeof(m_head), "%zx\r\n", m_bytes);
+        iv.push_back(iovec{m_head, (size_t)len});
+        total += len;
+        for (const segment &s : m_segs)
+            iv.push_back(iovec{(void *)(s.ref ? s.ref : &m_buf[s.off]), s.len});
+        total += m_bytes;
+        // chunk结尾的CRLF和结束块合成一段
+        const char *tail = last ? CRLF_LAST_CHUNK : CRLF;
+        size_t tail_len = last ? sizeof(CRLF_LAST_CHUNK) - 1 : sizeof(CRLF) - 1;
+        iv.push_back(iovec{(void *)tail, tail_len});
+        total += tail_len;
+    }
+    else if (last)
+    {
+        iv.push_back(iovec{(void *)LAST_CHUNK, sizeof(LAST_CHUNK) - 1});
+        total += sizeof(LAST_CHUNK) - 1;
+    }
+    return total;
+}
+
+dir_listing *dir_listing::open(const char *path, const char *url)
+{
+    DIR *dir = opendir(path);
+    if (!dir)
+        return NULL;
+    return new dir_listing(dir, url);
+}
+
+dir_listing::dir_listing(DIR *dir, const char *url) : m_dir(dir), m_url(url), m_started(false)
+{
+    if (m_url.empty() || m_url[m_url.size() - 1] != '/')
+        m_url += '/';
+}
+
+dir_listing::~dir_listing()
+{
+    closedir(m_dir);
+}
+
+void dir_listing::escape_html(chunk_writer &w, const char *s)
+{
+    for (const char *p = s; *p; ++p)
+    {
+        size_t n = strcspn(p, "&<>\"'");
+        w.write(p, n);
+        p += n;
+        switch (*p)
+        {
+        case '&': w.write("&amp;", 5); break;
+        case '<': w.write("&lt;", 4); break;
+        case '>': w.write("&gt;", 4); break;
+        case '"': w.write("&quot;", 6); break;
+        case '\'': w.write("&#39;", 5); break;
+        default: return;
+        }
+    }
+}
+
+void dir_listing::escape_url(chunk_writer &w, const char *s)
+{
+    static const char HEX[] = "0123456789ABCDEF";
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p)
+    {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || strchr("-._~", *p))
+        {
+            w.write((const char *)p, 1);
+            continue;
+        }
+        char esc[3] = {'%', HEX[*p >> 4], HEX[*p & 15]};
+        w.write(esc, 3);
+    }
+}
+
+bool dir_listing::produce(chunk_writer &w)
+{
+    if (!m_started)
+    {
+        m_started = true;
+        w.write("<html><head><meta charset=\"utf-8\"><title>Index of ");
+        escape_html(w, m_url.c_str());
+        w.write("</title></head><body><h1>Index of ");
+        escape_html(w, m_url.c_str());
+        w.write("</h1><ul>\n");
+    }
+    for (int i = 0; i < DIR_BATCH_ENTRIES && !w.full(); ++i)
+    {
+        struct dirent *ent = readdir(m_dir);
+        if (!ent)
+        {
+            w.write("</ul></body></html>\n");
+            return false;
+        }
+        // 不列出隐藏文件，也就不会有.和..
+        if ('.' == ent->d_name[0])
+            continue;
+        bool is_dir = DT_DIR == ent->d_type;
+        // 有的文件系统不填d_type，这时查一次文件属性
+        struct stat st;
+        if (DT_UNKNOWN == ent->d_type && 0 == fstatat(dirfd(m_dir), ent->d_name, &st, 0))
+            is_dir = S_ISDIR(st.st_mode);
+        w.write("<li><a href=\"");
+        escape_html(w, m_url.c_str());
+        escape_url(w, ent->d_name);
+        w.write(is_dir ? "/\">" : "\">");
+        escape_html(w, ent->d_name);
+        w.write(is_dir ? "/</a></li>\n" : "</a></li>\n");
+    }
+    return true;
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (char *buf : m_free)
+        delete[] buf;
+}
+
+char *buffer_pool::acquire()
+{
+    m_lock.lock();
+    if (!m_free.empty())
+    {
+        char *buf = m_free.back();
+        m_free.pop_back();
+        m_lock.unlock();
+        return buf;
+    }
+    m_lock.unlock();
+    return new char[FILE_WINDOW_SIZE];
+}
+
+void buffer_pool::release(char *buf)
+{
+    m_lock.lock();
+    if (m_free.size() < POOL_MAX_FREE)
+    {
+        m_free.push_back(buf);
+        buf = NULL;
+    }
+    m_lock.unlock();
+    delete[] buf;
+}
+
+file_window *file_window::open(const char *path, off_t offset, off_t len)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    // 顺序读让内核加大预读窗口，再先把第一个窗口读进页缓存
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+    readahead(fd, offset, FILE_WINDOW_SIZE);
+    return new file_window(fd, offset, len);
+}
+
+file_window::file_window(int fd, off_t offset, off_t len)
+    : m_fd(fd), m_offset(offset), m_end(offset + len), m_buf(NULL), m_failed(false)
+{
+}
+
+file_window::~file_window()
+{
+    if (m_buf)
+        buffer_pool::get_instance()->release(m_buf);
+    close(m_fd);
+}
+
+bool file_window::produce(chunk_writer &w)
+{
+    if (m_offset >= m_end)
+        return false;
+    // 缓冲区在第一次读时才取，只发响应头就出错的连接不占用
+    if (!m_buf)
+        m_buf = buffer_pool::get_instance()->acquire();
+    size_t want = m_end - m_offset < (off_t)FILE_WINDOW_SIZE ? m_end - m_offset : FILE_WINDOW_SIZE;
+    ssize_t n = pread(m_fd, m_buf, want, m_offset);
+    // 文件在发送途中被截断或读出错
+    if (n <= 0)
+    {
+        m_failed = true;
+        return false;
+    }
+    w.write_ref(m_buf, n);
+    m_offset += n;
+    if (m_offset >= m_end)
+        return false;
+    // 这个窗口发送期间让内核读下一个窗口，下一次pread就不用等磁盘
+    readahead(m_fd, m_offset, FILE_WINDOW_SIZE);
+    return true;
+}
@@ -0,0 +1,138 @@
+/*************************************************************
+*流式响应
+*长度事先未知的响应体（目录列表、生成的页面）用分块编码发送，
+*生产者每次只生成一批，这一批全部写进socket之后才会生成下一批，
+*发送缓冲满时等EPOLLOUT，连接上同时只占用一批的内存。
+*大文件也走这条路径，按窗口pread进池化的缓冲区，不整体mmap
+**************************************************************/
+
+#ifndef HTTP_STREAM_H
+#define HTTP_STREAM_H
+
+#include <sys/uio.h>
+#include <dirent.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+// 一批输出达到这么多字节或这么多段时生产者应当停下，等这一批发完
+static const size_t STREAM_BATCH_BYTES = 64 * 1024;
+static const size_t STREAM_BATCH_SEGS = 256;
+// 大文件每次读取的窗口大小，也是连接发送大文件时占用的内存
+static const size_t FILE_WINDOW_SIZE = 128 * 1024;
+
+// 收集一批输出，整批作为一个chunk发送
+class chunk_writer
+{
+public:
+    chunk_writer() : m_bytes(0) {}
+
+    // 复制一段数据
+    void write(const char *data, size_t len);
+    void write(const char *s) { write(s, strlen(s)); }
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    // 不复制，data在这一批发完之前必须保持有效
+    void write_ref(const void *data, size_t len);
+    // 这一批已经够大，生产者应当返回
+    bool full() const { return m_bytes >= STREAM_BATCH_BYTES || m_segs.size() >= STREAM_BATCH_SEGS; }
+    size_t size() const { return m_bytes; }
+
+    // 清空上一批，缓冲区的容量保留给下一批
+    void reset();
+    // 把这一批追加到iv，返回追加的字节数；chunked时加上chunk头尾，last时再加上结束块
+    size_t finish(bool chunked, bool last, std::vector<struct iovec> &iv);
+
+private:
+    // ref为空时数据在m_buf的off处，m_buf扩容会移动数据，到finish时才取地址
+    struct segment
+    {
+        const char *ref;
+        size_t off;
+        size_t len;
+    };
+    std::string m_buf;
+    std::vector<segment> m_segs;
+    size_t m_bytes;
+    char m_head[24];
+};
+
+// 流式响应的生产者，由发送响应的线程调用：proactor下是主线程，
+// reactor和长连接的乐观写下是工作线程，所以produce不能阻塞
+class stream_source
+{
+public:
+    virtual ~stream_source() {}
+    // 响应体类型
+    virtual const char *content_type() const { return "text/html"; }
+    // 长度已经由Content-Length给出的不用分块编码
+    virtual bool chunked() const { return true; }
+    // 往w里写下一批，还有后续输出时返回true；返回true却什么都没写也视为结束
+    virtual bool produce(chunk_writer &w) = 0;
+    // 输出没能完整生成，已经发出的响应头和长度对不上，只能关闭连接
+    virtual bool failed() const { return false; }
+};
+
+// 定长缓冲区池，大文件窗口发完后缓冲区回到池里给下一个连接用
+class buffer_pool
+{
+public:
+    static buffer_pool *get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+    // FILE_WINDOW_SIZE字节的缓冲区
+    char *acquire();
+    void release(char *buf);
+
+private:
+    buffer_pool() {}
+    ~buffer_pool();
+
+    locker m_lock;
+    std::vector<char *> m_free;
+};
+
+// 大文件的[offset, offset + len)区间，每批pread一个窗口，发完再读下一个
+class file_window : public stream_source
+{
+public:
+    // 打开失败时返回NULL
+    static file_window *open(const char *path, off_t offset, off_t len);
+    ~file_window();
+    bool chunked() const { return false; }
+    bool produce(chunk_writer &w);
+    bool failed() const { return m_failed; }
+
+private:
+    file_window(int fd, off_t offset, off_t len);
+
+    int m_fd;
+    off_t m_offset;
+    off_t m_end;
+    char *m_buf;
+    bool m_failed;
+};
+
+// 目录列表，每批读一部分目录项，大目录不用一次读完
+class dir_listing : public stream_source
+{
+public:
+    // url是请求的路径，用来生成链接；打开失败时返回NULL
+    static dir_listing *open(const char *path, const char *url);
+    ~dir_listing();
+    bool produce(chunk_writer &w);
+
+private:
+    dir_listing(DIR *dir, const char *url);
+    // 目录名和链接中需要转义的字符
+    static void escape_html(chunk_writer &w, const char *s);
+    static void escape_url(chunk_writer &w, const char *s);
+
+    DIR *m_dir;
+    std::string m_url;
+    bool m_started;
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 // 线程同步机制封装类
 
@@ -50,6 +51,20 @@ public:
         // 原子操作方式,作用是从信号量的值减去一个“1”，但它永远会先等待该信号量为一个非零值才开始做减法。
         return sem_wait(&m_sem) == 0;
     }
+    // 超时等待信号量，ms毫秒内没有等到返回false
+    bool timewait(int ms)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += (ms % 1000) * 1000000L;
+        if (t.tv_nsec >= 1000000000L)
+        {
+            t.tv_sec += 1;
+            t.tv_nsec -= 1000000000L;
+        }
+        return sem_timedwait(&m_sem, &t) == 0;
+    }
     // 释放信号量。信号量值加1。并通知其他等待线程。
     bool post()
     {
@@ -0,0 +1,199 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "access_log.h"
+
+// 路径字典最多记录的条数，防止随意构造的URL把字典撑大
+static const size_t MAX_PATH_IDS = 65536;
+
+access_log::access_log()
+{
+    m_enabled.store(false);
+    m_segment_records = 0;
+    m_seq = 0;
+    m_current.store(NULL);
+    m_paths = NULL;
+}
+
+access_log::~access_log()
+{
+    m_enabled.store(false);
+    segment *cur = m_current.load();
+    if (cur)
+    {
+        close_segment(cur);
+        delete cur;
+    }
+    for (size_t i = 0; i < m_retired.size(); ++i)
+        delete m_retired[i];
+    if (m_paths)
+        fclose(m_paths);
+}
+
+bool access_log::init(const char *base_name, int segment_records)
+{
+    m_base_name = base_name;
+    m_segment_records = segment_records > 0 ? segment_records : 1 << 20;
+
+    std::string paths = m_base_name + ".paths";
+    m_paths = fopen(paths.c_str(), "a");
+    if (m_paths == NULL)
+        return false;
+
+    segment *seg = open_segment();
+    if (seg == NULL)
+        return false;
+    m_current.store(seg);
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+access_log::segment *access_log::open_segment()
+{
+    // 跳过已有的段文件，重启后不覆盖旧数据
+    char name[256];
+    int fd = -1;
+    while (fd < 0)
+    {
+        snprintf(name, sizeof(name), "%s.%06d", m_base_name.c_str(), ++m_seq);
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno != EEXIST)
+            return NULL;
+    }
+
+    // 文件按容量预先扩展，未写的部分是空洞，不占磁盘
+    size_t len = ACCESS_LOG_HEADER_SIZE + m_segment_records * sizeof(access_record);
+    if (ftruncate(fd, len) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    char *base = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    access_log_header *head = (access_log_header *)base;
+    memcpy(head->magic, ACCESS_LOG_MAGIC, sizeof(head->magic));
+    head->version = ACCESS_LOG_VERSION;
+    head->record_size = sizeof(access_record);
+    head->capacity = m_segment_records;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    head->create_usec = now.tv_sec * 1000000LL + now.tv_usec;
+
+    segment *seg = new segment;
+    seg->base = base;
+    seg->records = (access_record *)(base + ACCESS_LOG_HEADER_SIZE);
+    seg->capacity = m_segment_records;
+    seg->fd = fd;
+    seg->next.store(0);
+    seg->writers.store(0);
+    return seg;
+}
+
+void access_log::close_segment(segment *seg)
+{
+    // 已经抢到位置的写线程很快就会写完
+    while (seg->writers.load(std::memory_order_acquire) != 0)
+        sched_yield();
+    uint64_t used = seg->next.load();
+    if (used > seg->capacity)
+        used = seg->capacity;
+    munmap(seg->base, ACCESS_LOG_HEADER_SIZE + seg->capacity * sizeof(access_record));
+    // 截掉没用到的空洞，文件长度就是记录数
+    ftruncate(seg->fd, ACCESS_LOG_HEADER_SIZE + used * sizeof(access_record));
+    close(seg->fd);
+}
+
+void access_log::rotate(segment *full)
+{
+    m_mutex.lock();
+    // 多个线程同时发现写满时只切换一次
+    if (m_current.load() == full)
+    {
+        segment *seg = open_segment();
+        if (seg == NULL)
+        {
+            m_enabled.store(false, std::memory_order_release);
+            m_mutex.unlock();
+            return;
+        }
+        m_current.store(seg);
+        m_retired.push_back(full);
+        close_segment(full);
+    }
+    m_mutex.unlock();
+}
+
+uint16_t access_log::worker_id()
+{
+    static std::atomic<int> s_next(0);
+    static thread_local int t_id = -1;
+    if (t_id < 0)
+        t_id = s_next.fetch_add(1);
+    return t_id;
+}
+
+void access_log::record_path(uint32_t id, const char *path)
+{
+    // 每个线程先查自己见过的路径，同一路径只在第一次出现时加锁
+    static thread_local std::unordered_set<uint32_t> t_seen;
+    if (t_seen.count(id) || t_seen.size() >= MAX_PATH_IDS)
+        return;
+    t_seen.insert(id);
+
+    m_paths_mutex.lock();
+    if (m_seen_paths.size() < MAX_PATH_IDS && m_seen_paths.insert(id).second)
+    {
+        fprintf(m_paths, "%08x %s\n", id, path);
+        fflush(m_paths);
+    }
+    m_paths_mutex.unlock();
+}
+
+void access_log::append(uint32_t ip, int method, const char *path, int status, uint64_t bytes, uint64_t latency_ns)
+{
+    if (!path)
+        path = "-";
+    uint32_t path_id = access_path_id(path);
+    record_path(path_id, path);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    while (m_enabled.load(std::memory_order_acquire))
+    {
+        segment *seg = m_current.load();
+        // 先登记再确认段没有被切换，切换方据此等待写完
+        seg->writers.fetch_add(1);
+        if (m_current.load() != seg)
+        {
+            seg->writers.fetch_sub(1);
+            continue;
+        }
+        uint64_t idx = seg->next.fetch_add(1, std::memory_order_relaxed);
+        if (idx < seg->capacity)
+        {
+            access_record *rec = seg->records + idx;
+            rec->usec = now.tv_sec * 1000000LL + now.tv_usec;
+            rec->latency_ns = latency_ns;
+            rec->bytes = bytes;
+            rec->ip = ip;
+            rec->path_id = path_id;
+            rec->worker = worker_id();
+            rec->method = method;
+            __atomic_store_n(&rec->status, (uint16_t)status, __ATOMIC_RELEASE);
+            seg->writers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        seg->writers.fetch_sub(1, std::memory_order_release);
+        rotate(seg);
+    }
+}
@@ -0,0 +1,121 @@
+/*************************************************************
+*二进制访问日志
+*每个请求一条定长记录，写入预分配并mmap的只追加段文件
+*写线程用一次fetch_add抢占记录位置，直接写映射内存，不加锁也不格式化
+*段写满后切换到下一个段文件，路径只记录32位哈希，原文写入同名.paths字典
+*离线用access_query统计
+**************************************************************/
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include "../lock/locker.h"
+
+#define ACCESS_LOG_MAGIC "TWACLOG1"
+#define ACCESS_LOG_VERSION 1
+
+// 段文件头，记录从ACCESS_LOG_HEADER_SIZE偏移处开始
+struct access_log_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;   // 段中可容纳的记录数
+    int64_t create_usec; // 段创建时间
+};
+
+static const int ACCESS_LOG_HEADER_SIZE = 64;
+
+// 定长记录，status最后写入，为0表示该位置尚未写完
+struct access_record
+{
+    int64_t usec;        // 响应发送完的时刻，微秒
+    uint64_t latency_ns; // 从收到请求第一个字节到响应发送完
+    uint64_t bytes;      // 发送的字节数，包含响应头
+    uint32_t ip;         // 客户端IPv4地址，网络字节序
+    uint32_t path_id;    // 路径的FNV-1a哈希，原文见.paths字典
+    uint16_t status;     // HTTP状态码
+    uint16_t worker;     // 处理线程编号
+    uint8_t method;      // http_conn::METHOD
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(access_record) == 40, "access_record layout changed");
+
+// 32位FNV-1a哈希，服务器和查询工具共用
+inline uint32_t access_path_id(const char *path)
+{
+    uint32_t h = 2166136261u;
+    for (; *path; ++path)
+    {
+        h ^= (unsigned char)*path;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+class access_log
+{
+public:
+    static access_log *get_instance()
+    {
+        static access_log instance;
+        return &instance;
+    }
+
+    // base_name为段文件前缀，段文件为base_name.000001、base_name.000002...
+    // segment_records为每个段的记录数
+    bool init(const char *base_name, int segment_records = 1 << 20);
+
+    bool enabled() const
+    {
+        return m_enabled.load(std::memory_order_acquire);
+    }
+
+    void append(uint32_t ip, int method, const char *path, int status, uint64_t bytes, uint64_t latency_ns);
+
+private:
+    // 写线程进出段时计数，切换段后等计数归零才解除映射
+    struct segment
+    {
+        char *base;
+        access_record *records;
+        uint64_t capacity;
+        int fd;
+        std::atomic<uint64_t> next;
+        std::atomic<int> writers;
+    };
+
+    access_log();
+    virtual ~access_log();
+
+    segment *open_segment();
+    void close_segment(segment *seg);
+    // 当前段写满时由抢到越界位置的线程调用
+    void rotate(segment *full);
+    void record_path(uint32_t id, const char *path);
+    static uint16_t worker_id();
+
+private:
+    // 切换段失败时由rotate关闭，写线程在append里一直读它
+    std::atomic<bool> m_enabled;
+    std::string m_base_name;
+    uint64_t m_segment_records;
+    int m_seq;
+    std::atomic<segment *> m_current;
+    // 退役的段，进程退出时释放，写线程可能还持有指针
+    std::vector<segment *> m_retired;
+    locker m_mutex;
+
+    FILE *m_paths;
+    std::unordered_set<uint32_t> m_seen_paths;
+    locker m_paths_mutex;
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*************************************************************
+*二进制访问日志离线查询
+*mmap读取段文件，按条件过滤后分组统计请求数、字节数和延迟分位数
+*用法: ./access_query [-g all|path|status|method|worker|ip] [-s 状态码] [-p 路径]
+*                     [-f 起始unix秒] [-t 结束unix秒] [-d 路径字典] 段文件...
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "access_log.h"
+
+using namespace std;
+
+enum GROUP_BY
+{
+    GROUP_ALL = 0,
+    GROUP_PATH,
+    GROUP_STATUS,
+    GROUP_METHOD,
+    GROUP_WORKER,
+    GROUP_IP
+};
+
+static const char *METHOD_NAME[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
+
+struct group_stat
+{
+    uint64_t count;
+    uint64_t bytes;
+    vector<uint64_t> latency;
+};
+
+struct query
+{
+    int group;
+    int status;
+    bool has_path;
+    uint32_t path_id;
+    int64_t from_usec;
+    int64_t to_usec;
+};
+
+static void usage()
+{
+    fprintf(stderr, "usage: access_query [-g all|path|status|method|worker|ip] [-s status] [-p path]\n"
+                    "                    [-f from_unix_sec] [-t to_unix_sec] [-d paths_file] segment...\n");
+    exit(1);
+}
+
+// 段文件名为<前缀>.NNNNNN，字典为<前缀>.paths
+static string default_paths_file(const char *segment)
+{
+    string name = segment;
+    size_t dot = name.find_last_of('.');
+    if (dot != string::npos)
+        name.resize(dot);
+    return name + ".paths";
+}
+
+static void load_paths(const string &file, unordered_map<uint32_t, string> &paths)
+{
+    FILE *fp = fopen(file.c_str(), "r");
+    if (!fp)
+        return;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *sp = strchr(line, ' ');
+        if (!sp)
+            continue;
+        *sp = '\0';
+        char *path = sp + 1;
+        path[strcspn(path, "\n")] = '\0';
+        paths[(uint32_t)strtoul(line, NULL, 16)] = path;
+    }
+    fclose(fp);
+}
+
+static uint64_t group_key(const query &q, const access_record &rec)
+{
+    switch (q.group)
+    {
+    case GROUP_PATH:
+        return rec.path_id;
+    case GROUP_STATUS:
+        return rec.status;
+    case GROUP_METHOD:
+        return rec.method;
+    case GROUP_WORKER:
+        return rec.worker;
+    case GROUP_IP:
+        return rec.ip;
+    default:
+        return 0;
+    }
+}
+
+static string key_name(const query &q, uint64_t key, const unordered_map<uint32_t, string> &paths)
+{
+    char buf[64];
+    switch (q.group)
+    {
+    case GROUP_PATH:
+    {
+        auto it = paths.find((uint32_t)key);
+        if (it != paths.end())
+            return it->second;
+        snprintf(buf, sizeof(buf), "#%08x", (uint32_t)key);
+        return buf;
+    }
+    case GROUP_METHOD:
+        return key < sizeof(METHOD_NAME) / sizeof(METHOD_NAME[0]) ? METHOD_NAME[key] : "?";
+    case GROUP_IP:
+    {
+        struct in_addr addr;
+        addr.s_addr = (uint32_t)key;
+        inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+        return buf;
+    }
+    case GROUP_ALL:
+        return "all";
+    default:
+        snprintf(buf, sizeof(buf), "%llu", (unsigned long long)key);
+        return buf;
+    }
+}
+
+// 返回读取的记录数，文件格式不对时返回-1
+static long long scan_segment(const char *file, const query &q, unordered_map<uint64_t, group_stat> &groups)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < ACCESS_LOG_HEADER_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+    char *base = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    const access_log_header *head = (const access_log_header *)base;
+    if (memcmp(head->magic, ACCESS_LOG_MAGIC, sizeof(head->magic)) != 0 || head->record_size != sizeof(access_record))
+    {
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    // 服务器还在写的段按文件长度读，status为0的位置还没写完
+    uint64_t n = (st.st_size - ACCESS_LOG_HEADER_SIZE) / sizeof(access_record);
+    if (n > head->capacity)
+        n = head->capacity;
+    const access_record *recs = (const access_record *)(base + ACCESS_LOG_HEADER_SIZE);
+    long long scanned = 0;
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        const access_record &rec = recs[i];
+        if (rec.status == 0)
+            continue;
+        ++scanned;
+        if (q.status && rec.status != q.status)
+            continue;
+        if (q.has_path && rec.path_id != q.path_id)
+            continue;
+        if (rec.usec < q.from_usec || rec.usec >= q.to_usec)
+            continue;
+        group_stat &g = groups[group_key(q, rec)];
+        g.count++;
+        g.bytes += rec.bytes;
+        g.latency.push_back(rec.latency_ns);
+    }
+    munmap(base, st.st_size);
+    return scanned;
+}
+
+static double percentile_us(const vector<uint64_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[idx] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    query q;
+    q.group = GROUP_ALL;
+    q.status = 0;
+    q.has_path = false;
+    q.path_id = 0;
+    q.from_usec = 0;
+    q.to_usec = INT64_MAX;
+    string paths_file;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:s:p:f:t:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+        {
+            const char *names[] = {"all", "path", "status", "method", "worker", "ip"};
+            q.group = -1;
+            for (int i = 0; i < 6; ++i)
+                if (strcmp(optarg, names[i]) == 0)
+                    q.group = i;
+            if (q.group < 0)
+                usage();
+            break;
+        }
+        case 's':
+            q.status = atoi(optarg);
+            break;
+        case 'p':
+            q.has_path = true;
+            q.path_id = access_path_id(optarg);
+            break;
+        case 'f':
+            q.from_usec = atoll(optarg) * 1000000LL;
+            break;
+        case 't':
+            q.to_usec = atoll(optarg) * 1000000LL;
+            break;
+        case 'd':
+            paths_file = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    unordered_map<uint32_t, string> paths;
+    load_paths(paths_file.empty() ? default_paths_file(argv[optind]) : paths_file, paths);
+
+    unordered_map<uint64_t, group_stat> groups;
+    long long total = 0;
+    for (int i = optind; i < argc; ++i)
+    {
+        long long n = scan_segment(argv[i], q, groups);
+        if (n < 0)
+        {
+            fprintf(stderr, "skip %s: not an access log segment\n", argv[i]);
+            continue;
+        }
+        total += n;
+    }
+
+    // 按请求数从多到少输出
+    vector<pair<uint64_t, group_stat *> > order;
+    for (auto &it : groups)
+        order.push_back(make_pair(it.first, &it.second));
+    sort(order.begin(), order.end(), [](const pair<uint64_t, group_stat *> &a, const pair<uint64_t, group_stat *> &b) {
+        return a.second->count > b.second->count;
+    });
+
+    printf("records=%lld groups=%zu\n", total, order.size());
+    printf("%-32s %10s %14s %10s %10s %10s %10s %10s\n", "key", "count", "bytes", "p50(us)", "p90(us)", "p99(us)", "p999(us)", "max(us)");
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        group_stat &g = *order[i].second;
+        sort(g.latency.begin(), g.latency.end());
+        printf("%-32s %10llu %14llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", key_name(q, order[i].first, paths).c_str(),
+               (unsigned long long)g.count, (unsigned long long)g.bytes, percentile_us(g.latency, 0.5),
+               percentile_us(g.latency, 0.9), percentile_us(g.latency, 0.99), percentile_us(g.latency, 0.999),
+               g.latency.back() / 1000.0);
+    }
+    return 0;
+}
@@ -1,6 +1,8 @@
 /*************************************************************
-*循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;  
-*线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+*有界多生产者/单消费者无锁环形队列
+*每个槽位带一个序号，生产者CAS抢占写位置后在槽位内原地写入，再发布序号
+*消费者按序号判断槽位是否可读，队列为空时按等待策略自旋、让出CPU或futex休眠
+*push/pop都不加锁，full/empty/size只是瞬时值
 **************************************************************/
 
 #ifndef BLOCK_QUEUE_H
@@ -8,205 +10,204 @@
 
 #include <iostream>
 #include <stdlib.h>
-#include <pthread.h>
-#include <sys/time.h>
-#include "../lock/locker.h"
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 using namespace std;
 
+//消费者在队列为空时的等待策略
+enum QUEUE_WAIT
+{
+    QUEUE_WAIT_SPIN = 0, //忙等，延迟最低，独占一个核
+    QUEUE_WAIT_YIELD,    //sched_yield让出CPU
+    QUEUE_WAIT_FUTEX     //futex休眠，生产者发现消费者在睡时才唤醒
+};
+
 template <class T>
 class block_queue
 {
 public:
-    block_queue(int max_size = 1000)
+    //max_size会被向上取整为2的幂
+    block_queue(int max_size = 1000, int wait = QUEUE_WAIT_FUTEX)
     {
         if (max_size <= 0)
         {
             exit(-1);
         }
 
-        m_max_size = max_size;
-        m_array = new T[max_size];
-        m_size = 0;
-        m_front = -1;
-        m_back = -1;
-    }
-
-    void clear()
-    {
-        m_mutex.lock();
-        m_size = 0;
-        m_front = -1;
-        m_back = -1;
-        m_mutex.unlock();
+        size_t cap = 2;
+        while (cap < (size_t)max_size)
+            cap <<= 1;
+        m_max_size = cap;
+        m_mask = cap - 1;
+        m_wait = wait;
+        m_cells = new cell[cap];
+        for (size_t i = 0; i < cap; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+        m_signal.store(0, std::memory_order_relaxed);
+        m_sleeping.store(false, std::memory_order_relaxed);
     }
 
     ~block_queue()
     {
-        m_mutex.lock();
-        if (m_array != NULL)
-            delete [] m_array;
-
-        m_mutex.unlock();
+        delete[] m_cells;
     }
+
     //判断队列是否满了
-    bool full() 
+    bool full()
     {
-        m_mutex.lock();
-        if (m_size >= m_max_size)
-        {
-
-            m_mutex.unlock();
-            return true;
-        }
-        m_mutex.unlock();
-        return false;
+        return size() >= (int)m_max_size;
     }
     //判断队列是否为空
-    bool empty() 
+    bool empty()
     {
-        m_mutex.lock();
-        if (0 == m_size)
-        {
-            m_mutex.unlock();
-            return true;
-        }
-        m_mutex.unlock();
-        return false;
+        return size() == 0;
     }
-    //返回队首元素
-    bool front(T &value) 
+
+    int size()
     {
-        m_mutex.lock();
-        if (0 == m_size)
-        {
-            m_mutex.unlock();
-            return false;
-        }
-        value = m_array[m_front];
-        m_mutex.unlock();
-        return true;
+        size_t tail = m_dequeue_pos.load(std::memory_order_acquire);
+        size_t head = m_enqueue_pos.load(std::memory_order_acquire);
+        return head > tail ? (int)(head - tail) : 0;
     }
-    //返回队尾元素
-    bool back(T &value) 
+
+    int max_size()
+    {
+        return m_max_size;
+    }
+
+    //抢占一个槽位，在槽位内原地构造元素，满时返回false
+    //fill(T &slot)在发布之前执行，其他线程看不到写了一半的元素
+    template <class F>
+    bool push_in_place(F fill)
     {
-        m_mutex.lock();
-        if (0 == m_size)
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
         {
-            m_mutex.unlock();
-            return false;
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
         }
-        value = m_array[m_back];
-        m_mutex.unlock();
+        fill(c->data);
+        c->seq.store(pos + 1, std::memory_order_release);
+        notify();
         return true;
     }
 
-    int size() 
+    bool push(const T &item)
     {
-        int tmp = 0;
-
-        m_mutex.lock();
-        tmp = m_size;
-
-        m_mutex.unlock();
-        return tmp;
+        return push_in_place([&](T &slot) { slot = item; });
     }
 
-    int max_size()
+    //只能由一个消费者线程调用，队列为空时按等待策略阻塞
+    //consume(T &slot)直接读取槽位，返回后槽位才交还给生产者
+    template <class F>
+    bool pop_in_place(F consume)
     {
-        int tmp = 0;
-
-        m_mutex.lock();
-        tmp = m_max_size;
-
-        m_mutex.unlock();
-        return tmp;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        cell *c = &m_cells[pos & m_mask];
+        int rounds = 0;
+        while (c->seq.load(std::memory_order_acquire) != pos + 1)
+            wait(c, pos, rounds++);
+        consume(c->data);
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_dequeue_pos.store(pos + 1, std::memory_order_release);
+        return true;
     }
-    //往队列添加元素，需要将所有使用队列的线程先唤醒
-    //当有元素push进队列,相当于生产者生产了一个元素
-    //若当前没有线程等待条件变量,则唤醒无意义
-    bool push(const T &item)
-    {
-
-        m_mutex.lock();
-        if (m_size >= m_max_size)
-        {
-
-            m_cond.broadcast();
-            m_mutex.unlock();
-            return false;
-        }
 
-        m_back = (m_back + 1) % m_max_size;
-        m_array[m_back] = item;
+    bool pop(T &item)
+    {
+        return pop_in_place([&](T &slot) { item = slot; });
+    }
 
-        m_size++;
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
 
-        m_cond.broadcast();
-        m_mutex.unlock();
-        return true;
-    }
-    //pop时,如果当前队列没有元素,将会等待条件变量
-    bool pop(T &item)
+    static long futex(std::atomic<uint32_t> *addr, int op, uint32_t val)
     {
+        return syscall(SYS_futex, (uint32_t *)addr, op, val, NULL, NULL, 0);
+    }
 
-        m_mutex.lock();
-        while (m_size <= 0)
+    //消费者在休眠时才需要唤醒，生产者平时只多一次原子读
+    void notify()
+    {
+        if (m_wait != QUEUE_WAIT_FUTEX)
+            return;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed))
         {
-            
-            if (!m_cond.wait(m_mutex.get()))
-            {
-                m_mutex.unlock();
-                return false;
-            }
+            m_signal.fetch_add(1, std::memory_order_release);
+            futex(&m_signal, FUTEX_WAKE_PRIVATE, 1);
         }
-
-        m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
-        m_size--;
-        m_mutex.unlock();
-        return true;
     }
 
-    //增加了超时处理
-    bool pop(T &item, int ms_timeout)
+    //futex策略先让出CPU几轮再休眠，突发写入时生产者不必每次都发起唤醒系统调用
+    void wait(cell *c, size_t pos, int rounds)
     {
-        struct timespec t = {0, 0};
-        struct timeval now = {0, 0};
-        gettimeofday(&now, NULL);
-        m_mutex.lock();
-        if (m_size <= 0)
+        if (m_wait == QUEUE_WAIT_FUTEX && rounds < FUTEX_YIELD_ROUNDS)
         {
-            t.tv_sec = now.tv_sec + ms_timeout / 1000;
-            t.tv_nsec = (ms_timeout % 1000) * 1000;
-            if (!m_cond.timewait(m_mutex.get(), t))
-            {
-                m_mutex.unlock();
-                return false;
-            }
+            sched_yield();
+            return;
         }
-
-        if (m_size <= 0)
+        switch (m_wait)
+        {
+        case QUEUE_WAIT_SPIN:
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            break;
+        case QUEUE_WAIT_YIELD:
+            sched_yield();
+            break;
+        default:
         {
-            m_mutex.unlock();
-            return false;
+            uint32_t sig = m_signal.load(std::memory_order_acquire);
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            //声明要睡之后再检查一次，避免错过生产者的唤醒
+            if (c->seq.load(std::memory_order_acquire) != pos + 1)
+                futex(&m_signal, FUTEX_WAIT_PRIVATE, sig);
+            m_sleeping.store(false, std::memory_order_relaxed);
+            break;
+        }
         }
-
-        m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
-        m_size--;
-        m_mutex.unlock();
-        return true;
     }
 
 private:
-    locker m_mutex;
-    cond m_cond;
-
-    T *m_array;
-    int m_size;
-    int m_max_size;
-    int m_front;
-    int m_back;
+    static const int FUTEX_YIELD_ROUNDS = 64;
+
+    cell *m_cells;
+    size_t m_max_size;
+    size_t m_mask;
+    int m_wait;
+    //生产者和消费者的位置放在不同的缓存行
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+    alignas(64) std::atomic<uint32_t> m_signal;
+    std::atomic<bool> m_sleeping;
 };
 
 #endif
@@ -2,7 +2,12 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <sched.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
 #include "log.h"
+#include "../timer/time_cache.h"
 #include <pthread.h>
 using namespace std;
 
@@ -10,23 +15,82 @@ Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_is_ring = false;
+    m_is_deferred = false;
+    m_stage = NULL;
+    m_render_rec = NULL;
+    m_ring_size = 0;
+    m_level = LOG_LEVEL_DEBUG;
+    m_flush_policy = LOG_FLUSH_INTERVAL;
+    m_flush_interval_ms = 1000;
+    m_flush_bytes = 65536;
+    m_unflushed = 0;
+    m_last_flush_ms = 0;
+    m_ring_count.store(0);
+    m_wake_pending.store(false);
+    m_stopping.store(false);
+    m_flusher_running = false;
+    m_shared_ring = NULL;
+    for (int i = 0; i < MAX_LOG_THREADS; ++i)
+    {
+        m_rings[i].store(NULL);
+        m_ring_idle[i].store(false);
+    }
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    //剩余的日志由shutdown写完；没有调用shutdown时刷盘线程可能还在写文件，不能关闭
+    if (m_fp != NULL && !m_flusher_running)
     {
         fclose(m_fp);
     }
 }
+
+void Log::shutdown()
+{
+    //在exit之前调用，此时时间缓存等单例都还在；先停下刷盘线程，再把环形缓冲区中剩余的日志写完
+    if (m_flusher_running)
+    {
+        m_stopping.store(true);
+        m_ring_wake.post();
+        pthread_join(m_flush_tid, NULL);
+        m_flusher_running = false;
+        flush_rings();
+    }
+    if (m_fp != NULL)
+    {
+        m_mutex.lock();
+        fflush(m_fp);
+        m_mutex.unlock();
+    }
+}
 //异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size,
+               int ring_size, bool deferred, int queue_wait)
 {
+    //如果设置了ring_size,则每个线程写自己的环形缓冲区,由刷盘线程批量写文件
+    if (ring_size > 0)
+    {
+        m_is_ring = true;
+        m_ring_size = ring_size;
+        m_shared_ring = new log_ring(ring_size);
+        //延迟格式化，刷盘线程负责解码记录
+        if (deferred)
+        {
+            m_is_deferred = true;
+            if (log_buf_size > LOG_RENDER_MAX - 64)
+                log_buf_size = LOG_RENDER_MAX - 64;
+            m_stage = new char[LOG_STAGE_SIZE];
+            m_render_rec = new char[log_buf_size];
+        }
+        m_flusher_running = 0 == pthread_create(&m_flush_tid, NULL, flush_ring_thread, NULL);
+    }
     //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
+    else if (max_queue_size >= 1)
     {
         m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
+        m_log_queue = new block_queue<log_line>(max_queue_size, queue_wait);
         pthread_t tid;
         //flush_log_thread为回调函数,这里表示创建线程异步写日志
         pthread_create(&tid, NULL, flush_log_thread, NULL);
@@ -68,97 +132,524 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+void Log::roll_file(const struct tm &my_tm)
+{
+    char new_log[256] = {0};
+    fflush(m_fp);
+    fclose(m_fp);
+    char tail[16] = {0};
+
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+
+    if (m_today != my_tm.tm_mday)
+    {
+        snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
+        m_today = my_tm.tm_mday;
+        m_count = 0;
+    }
+    else
+    {
+        snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+    }
+    m_fp = fopen(new_log, "a");
+}
+
+const char *Log::level_tag(int level)
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
     switch (level)
     {
     case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
+        return "[debug]:";
     case 2:
-        strcpy(s, "[warn]:");
-        break;
+        return "[warn]:";
     case 3:
-        strcpy(s, "[erro]:");
-        break;
+        return "[erro]:";
     default:
-        strcpy(s, "[info]:");
-        break;
+        return "[info]:";
     }
-    //写入一个log，对m_count++, m_split_lines最大行数
-    m_mutex.lock();
-    m_count++;
+}
+
+int Log::format_prefix(const struct timeval &tv, int level, char *out, int *mday)
+{
+    //时间部分来自按秒缓存，这里只拼接微秒和级别
+    int n = time_cache::get_instance()->log_time(tv, out, mday);
+    const char *tag = level_tag(level);
+    size_t len = strlen(tag);
+    memcpy(out + n, tag, len);
+    out[n + len] = ' ';
+    return n + len + 1;
+}
 
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
+void Log::write_log(int level, const char *format, ...)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    //环形缓冲区模式下不加锁，切分文件由刷盘线程负责
+    if (m_is_ring)
     {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-       
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
-        if (m_today != my_tm.tm_mday)
-        {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }
-        else
-        {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
+        va_list valst;
+        va_start(valst, format);
+        write_ring(now, level, format, valst);
+        va_end(valst);
+        return;
     }
- 
-    m_mutex.unlock();
+    char prefix[48];
+    int n = format_prefix(now, level, prefix);
 
     va_list valst;
     va_start(valst, format);
 
-    string log_str;
+    //异步写入时直接在队列槽位中格式化，全程不加锁
+    if (m_is_async && push_queue(level, prefix, n, format, valst))
+    {
+        va_end(valst);
+        return;
+    }
+
+    //同步写入，或者队列满了退化为同步写入
     m_mutex.lock();
+    //写入一个log，对m_count++, m_split_lines最大行数
+    rotate_if_needed(1);
 
     //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+    memcpy(m_buf, prefix, n);
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m < 0)
+        m = 0;
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
     m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-
+    fwrite(m_buf, 1, n + m + 1, m_fp);
+    if (need_flush(level, n + m + 1))
+        fflush(m_fp);
     m_mutex.unlock();
 
-    if (m_is_async && !m_log_queue->full())
-    {
-        m_log_queue->push(log_str);
-    }
-    else
-    {
+    va_end(valst);
+}
+
+bool Log::push_queue(int level, const char *prefix, int n, const char *format, va_list valst)
+{
+    return m_log_queue->push_in_place([&](log_line &line) {
+        va_list args;
+        va_copy(args, valst);
+        memcpy(line.text, prefix, n);
+        int m = vsnprintf(line.text + n, log_line::LINE_MAX_LEN - n - 1, format, args);
+        va_end(args);
+        if (m < 0)
+            m = 0;
+        if (m > log_line::LINE_MAX_LEN - n - 2)
+            m = log_line::LINE_MAX_LEN - n - 2;
+        line.text[n + m] = '\n';
+        line.len = n + m + 1;
+        line.level = level;
+    });
+}
+
+void *Log::async_write_log()
+{
+    //从无锁队列中取出一条日志，直接从槽位写入文件
+    while (m_log_queue->pop_in_place([this](log_line &line) {
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        rotate_if_needed(1);
+        fwrite(line.text, 1, line.len, m_fp);
+        if (need_flush(line.level, line.len))
+            fflush(m_fp);
         m_mutex.unlock();
+    }))
+    {
     }
+    return NULL;
+}
 
-    va_end(valst);
+void Log::rotate_if_needed(long long lines)
+{
+    long long before = m_count;
+    m_count += lines;
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    char prefix[48];
+    int today = 0;
+    time_cache::get_instance()->log_time(now, prefix, &today);
+    if (m_today != today || m_count / m_split_lines != before / m_split_lines)
+    {
+        time_t t = now.tv_sec;
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
+        roll_file(my_tm);
+    }
 }
 
 void Log::flush(void)
 {
+    //环形缓冲区由刷盘线程统一写出，这里只唤醒刷盘线程
+    if (m_is_ring)
+    {
+        wake_flusher();
+        return;
+    }
     m_mutex.lock();
     //强制刷新写入流缓冲区
     fflush(m_fp);
+    m_unflushed = 0;
     m_mutex.unlock();
 }
+
+void Log::set_flush_policy(int policy, int interval_ms, int bytes)
+{
+    m_flush_policy = policy;
+    m_flush_interval_ms = interval_ms > 0 ? interval_ms : 1000;
+    m_flush_bytes = bytes > 0 ? bytes : 65536;
+}
+
+bool Log::need_flush(int level, size_t bytes)
+{
+    m_unflushed += bytes;
+    bool ret = false;
+    switch (m_flush_policy)
+    {
+    case LOG_FLUSH_BYTES:
+        ret = m_unflushed >= (size_t)m_flush_bytes;
+        break;
+    case LOG_FLUSH_WARN:
+        ret = level >= LOG_LEVEL_WARN;
+        break;
+    default:
+    {
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        long long ms = now.tv_sec * 1000LL + now.tv_usec / 1000;
+        ret = ms - m_last_flush_ms >= m_flush_interval_ms;
+        if (ret)
+            m_last_flush_ms = ms;
+        break;
+    }
+    }
+    if (ret)
+        m_unflushed = 0;
+    return ret;
+}
+
+//线程退出时交还槽位，环形缓冲区连同还没写出的日志一起留给下一个注册的线程
+struct log_ring_owner
+{
+    int idx = -1;
+    log_ring *ring = NULL;
+    ~log_ring_owner()
+    {
+        if (idx >= 0)
+            Log::get_instance()->release_ring(idx);
+    }
+};
+
+void Log::release_ring(int idx)
+{
+    m_ring_idle[idx].store(true, std::memory_order_release);
+}
+
+log_ring *Log::local_ring()
+{
+    static thread_local log_ring_owner t_owner;
+    if (t_owner.ring)
+        return t_owner.ring;
+
+    //先找已退出线程留下的槽位，之前的写入对接手的线程可见
+    int num = m_ring_count.load(std::memory_order_acquire);
+    if (num > MAX_LOG_THREADS)
+        num = MAX_LOG_THREADS;
+    for (int i = 0; i < num; ++i)
+    {
+        bool idle = true;
+        if (m_ring_idle[i].compare_exchange_strong(idle, false, std::memory_order_acq_rel))
+        {
+            t_owner.idx = i;
+            t_owner.ring = m_rings[i].load(std::memory_order_acquire);
+            return t_owner.ring;
+        }
+    }
+
+    int idx = m_ring_count.fetch_add(1);
+    if (idx >= MAX_LOG_THREADS)
+        return NULL;
+    t_owner.ring = new log_ring(m_ring_size);
+    m_rings[idx].store(t_owner.ring, std::memory_order_release);
+    t_owner.idx = idx;
+    return t_owner.ring;
+}
+
+void Log::wake_flusher()
+{
+    if (!m_wake_pending.exchange(true))
+        m_ring_wake.post();
+}
+
+char *Log::local_buf()
+{
+    //每个线程使用自己的格式化缓冲区，不再共享m_buf
+    static thread_local char *t_buf = NULL;
+    if (!t_buf)
+        t_buf = new char[m_log_buf_size];
+    return t_buf;
+}
+
+void Log::write_ring(const struct timeval &now, int level, const char *format, va_list valst)
+{
+    char *buf = local_buf();
+    int n = 0;
+    int m = 0;
+    if (m_is_deferred)
+    {
+        //延迟格式化模式下文本日志也以记录的形式写入，时间前缀由刷盘线程补上
+        n = sizeof(log_record_head);
+        m = vsnprintf(buf + n, m_log_buf_size - n, format, valst);
+        if (m < 0)
+            m = 0;
+        if (m > m_log_buf_size - n - 1)
+            m = m_log_buf_size - n - 1;
+        size_t len = (n + m + 1 + 7) & ~(size_t)7;
+        if (len > (size_t)m_log_buf_size)
+            len = m_log_buf_size & ~7;
+        buf[len - 1] = '\0';
+        log_record_head *head = (log_record_head *)buf;
+        head->len = len;
+        head->level = level;
+        head->usec = now.tv_sec * 1000000LL + now.tv_usec;
+        head->format = NULL;
+        head->fn = NULL;
+        push_ring(buf, len, level);
+        return;
+    }
+
+    n = format_prefix(now, level, buf);
+    m = vsnprintf(buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m < 0)
+        m = 0;
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    buf[n + m] = '\n';
+    push_ring(buf, n + m + 1, level);
+}
+
+void Log::push_ring(const char *buf, size_t len, int level)
+{
+    log_ring *ring = local_ring();
+    size_t used = 0;
+    if (ring)
+    {
+        //缓冲区满时等待刷盘线程腾出空间，不丢日志
+        while (!ring->push(buf, len))
+        {
+            wake_flusher();
+            sched_yield();
+        }
+        used = ring->used();
+    }
+    else
+    {
+        //同时存活的线程数超过上限，共用一个加锁的环形缓冲区，同样由刷盘线程写出
+        ring = m_shared_ring;
+        m_mutex.lock();
+        while (!ring->push(buf, len))
+        {
+            m_mutex.unlock();
+            wake_flusher();
+            sched_yield();
+            m_mutex.lock();
+        }
+        used = ring->used();
+        m_mutex.unlock();
+    }
+    //刷盘线程平时按m_flush_interval_ms批量写，以下情况提前唤醒
+    if (used > ring->capacity() / 2 ||
+        (m_flush_policy == LOG_FLUSH_BYTES && used >= (size_t)m_flush_bytes) ||
+        (m_flush_policy == LOG_FLUSH_WARN && level >= LOG_LEVEL_WARN))
+        wake_flusher();
+}
+
+size_t Log::render_record(const log_record_head *head, char *out, size_t cap)
+{
+    struct timeval tv;
+    tv.tv_sec = head->usec / 1000000;
+    tv.tv_usec = head->usec % 1000000;
+    int n = format_prefix(tv, head->level, out);
+    const char *payload = (const char *)(head + 1);
+    int m = 0;
+    if (head->fn)
+    {
+        m = head->fn(out + n, cap - n - 1, head->format, payload);
+    }
+    else
+    {
+        m = strlen(payload);
+        if (m > (int)cap - n - 1)
+            m = cap - n - 1;
+        memcpy(out + n, payload, m);
+    }
+    if (m < 0)
+        m = 0;
+    if (m > (int)cap - n - 2)
+        m = cap - n - 2;
+    out[n + m] = '\n';
+    return n + m + 1;
+}
+
+// 从可能环绕的两段区域中按偏移拷贝数据
+static void copy_from_iov(const struct iovec *iov, int cnt, size_t off, char *dst, size_t len)
+{
+    for (int i = 0; i < cnt && len > 0; ++i)
+    {
+        if (off >= iov[i].iov_len)
+        {
+            off -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = iov[i].iov_len - off;
+        if (n > len)
+            n = len;
+        memcpy(dst, (const char *)iov[i].iov_base + off, n);
+        dst += n;
+        len -= n;
+        off = 0;
+    }
+}
+
+// 写出全部数据，处理部分写
+static void write_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t ret = writev(fd, iov, cnt > IOV_MAX ? IOV_MAX : cnt);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (cnt > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+}
+
+size_t Log::render_rings(struct iovec *iov, int cnt, size_t total, long long &lines)
+{
+    //逐条解码记录，格式化到暂存区，暂存区满了就写一次
+    int fd = fileno(m_fp);
+    size_t staged = 0;
+    char *rec = m_render_rec;
+    size_t off = 0;
+    while (off < total)
+    {
+        log_record_head head;
+        copy_from_iov(iov, cnt, off, (char *)&head, sizeof(head));
+        copy_from_iov(iov, cnt, off, rec, head.len);
+        if (LOG_STAGE_SIZE - staged < LOG_RENDER_MAX)
+        {
+            struct iovec out = {m_stage, staged};
+            write_all(fd, &out, 1);
+            staged = 0;
+        }
+        staged += render_record((const log_record_head *)rec, m_stage + staged, LOG_RENDER_MAX);
+        off += head.len;
+        ++lines;
+    }
+    struct iovec out = {m_stage, staged};
+    write_all(fd, &out, 1);
+    return total;
+}
+
+size_t Log::flush_rings()
+{
+    //只有刷盘线程和shutdown会进入，写日志线程不会碰这把锁
+    m_flush_mutex.lock();
+    size_t total = do_flush_rings();
+    m_flush_mutex.unlock();
+    return total;
+}
+
+size_t Log::do_flush_rings()
+{
+    //最后一个位置是超过上限的线程共用的环形缓冲区
+    struct iovec iov[2 * (MAX_LOG_THREADS + 1)];
+    size_t lens[MAX_LOG_THREADS + 1];
+    log_ring *rings[MAX_LOG_THREADS + 1];
+    int iov_at[MAX_LOG_THREADS + 1];
+    int iov_cnt[MAX_LOG_THREADS + 1];
+    int cnt = 0;
+    size_t total = 0;
+
+    int num = m_ring_count.load(std::memory_order_acquire);
+    if (num > MAX_LOG_THREADS)
+        num = MAX_LOG_THREADS;
+    ++num;
+    for (int i = 0; i < num; ++i)
+    {
+        rings[i] = i + 1 < num ? m_rings[i].load(std::memory_order_acquire) : m_shared_ring;
+        lens[i] = 0;
+        //注册到一半的线程槽位还是空的，每个槽位自己记段数，不依赖下一个槽位
+        iov_at[i] = cnt;
+        iov_cnt[i] = 0;
+        if (!rings[i])
+            continue;
+        lens[i] = rings[i]->peek(iov + cnt, iov_cnt[i]);
+        cnt += iov_cnt[i];
+        total += lens[i];
+    }
+    if (total == 0)
+        return 0;
+
+    long long lines = 0;
+    if (m_is_deferred)
+    {
+        //每个线程的记录独立解码，记录不会跨越两个线程的缓冲区
+        for (int i = 0; i < num; ++i)
+        {
+            if (lens[i])
+                render_rings(iov + iov_at[i], iov_cnt[i], lens[i], lines);
+        }
+    }
+    else
+    {
+        //统计本批的行数，用于按行切分
+        for (int i = 0; i < cnt; ++i)
+        {
+            const char *p = (const char *)iov[i].iov_base;
+            const char *end = p + iov[i].iov_len;
+            while ((p = (const char *)memchr(p, '\n', end - p)) != NULL)
+            {
+                ++lines;
+                ++p;
+            }
+        }
+        //一次writev写出所有线程的日志
+        write_all(fileno(m_fp), iov, cnt);
+    }
+    for (int i = 0; i < num; ++i)
+    {
+        if (lens[i])
+            rings[i]->consume(lens[i]);
+    }
+
+    //按天、按行数切分，刷盘线程是唯一写文件的线程，不需要加锁
+    rotate_if_needed(lines);
+    return total;
+}
+
+void *Log::async_flush_rings()
+{
+    //每轮都先等待，被唤醒或超时后再写，保证持续写日志时也能攒成大批量
+    while (!m_stopping.load())
+    {
+        m_ring_wake.timewait(m_flush_interval_ms);
+        m_wake_pending.store(false);
+        flush_rings();
+    }
+    return NULL;
+}
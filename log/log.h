@@ -6,10 +6,57 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include <utility>
+#include <sys/time.h>
+#include "../lock/locker.h"
 #include "block_queue.h"
+#include "log_ring.h"
+#include "log_record.h"
 #include "assert.h"
 using namespace std;
 
+//日志级别，低于最小级别的日志在格式化之前就被丢弃
+enum LOG_LEVEL
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+//编译期最小日志级别，低于该级别的日志宏展开后不产生任何代码
+//例如 make LOG_LEVEL=2 只保留WARN和ERROR
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+constexpr bool log_compiled(int level)
+{
+    return level >= LOG_COMPILE_LEVEL;
+}
+
+//刷盘策略
+//LOG_FLUSH_INTERVAL: 距离上次刷盘超过间隔时刷盘
+//LOG_FLUSH_BYTES: 未刷盘的字节数超过阈值时刷盘
+//LOG_FLUSH_WARN: 只有WARN及以上级别的日志立即刷盘
+enum LOG_FLUSH
+{
+    LOG_FLUSH_INTERVAL = 0,
+    LOG_FLUSH_BYTES,
+    LOG_FLUSH_WARN
+};
+
+//阻塞队列中的一条日志，生产者直接在槽位中格式化，不再经过string
+struct log_line
+{
+    static const int LINE_MAX_LEN = 2048;
+    int level;
+    int len;
+    char text[LINE_MAX_LEN];
+};
+
 class Log
 {
 public:
@@ -37,27 +84,91 @@ public:
     {
         return Log::get_instance()->async_write_log();
     }
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    static void *flush_ring_thread(void *args)
+    {
+        return Log::get_instance()->async_flush_rings();
+    }
+    //可选择的参数有日志文件、日志缓冲区大小、最大行数、最长日志条队列以及每线程环形缓冲区大小
+    //ring_size大于0时使用每线程环形缓冲区 + 后台批量刷盘，写日志路径上不加锁
+    //deferred为true时只记录格式串和原始参数，由刷盘线程格式化
+    //queue_wait为阻塞队列为空时写日志线程的等待策略，见QUEUE_WAIT
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0,
+              int ring_size = 0, bool deferred = false, int queue_wait = QUEUE_WAIT_FUTEX);
 
     void write_log(int level, const char *format, ...);
 
+    //日志宏的入口，按写入方式选择立即格式化还是延迟格式化
+    template <typename... Args>
+    void log(int level, const char *format, Args... args)
+    {
+        if (m_is_deferred)
+            write_deferred(level, format, args...);
+        else
+            write_log(level, format, args...);
+    }
+
     void flush(void);
+    //进程退出前调用：停止并等待刷盘线程，写完环形缓冲区中剩余的日志
+    void shutdown();
+    //线程退出时交还环形缓冲区的槽位
+    void release_ring(int idx);
+
+    //设置最小日志级别，在启动工作线程之前调用
+    void set_level(int level)
+    {
+        m_level = level;
+    }
+    bool level_enabled(int level) const
+    {
+        return level >= m_level;
+    }
+    //设置刷盘策略，interval_ms同时作为异步刷盘线程空闲时的最长等待时间
+    void set_flush_policy(int policy, int interval_ms = 1000, int bytes = 65536);
 
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
+    void *async_write_log();
+    // 在队列槽位中原地格式化，队列满时返回false
+    bool push_queue(int level, const char *prefix, int n, const char *format, va_list valst);
+    // 累加行数，按天或按行数切分日志文件，调用者保证此时没有其他线程写m_fp
+    void rotate_if_needed(long long lines);
+    template <typename... Args>
+    void write_deferred(int level, const char *format, const Args &... args)
     {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
+        size_t len = log_record_size(args...);
+        //参数过长的记录退化为在本线程格式化
+        if (len > (size_t)m_log_buf_size)
         {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
+            write_log(level, format, args...);
+            return;
         }
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        char *buf = local_buf();
+        log_record_encode(buf, len, level, now.tv_sec * 1000000LL + now.tv_usec, format, args...);
+        push_ring(buf, len, level);
     }
+    static const char *level_tag(int level);
+    // 写入"时间 级别 "前缀，返回长度
+    int format_prefix(const struct timeval &tv, int level, char *out, int *mday = NULL);
+    //按刷盘策略判断本次写入后是否需要fflush，调用者持有m_mutex
+    bool need_flush(int level, size_t bytes);
+    void *async_flush_rings();
+    // 把所有线程环形缓冲区中的日志合并为一次writev，返回写出的字节数
+    size_t flush_rings();
+    size_t do_flush_rings();
+    // 取得当前线程的环形缓冲区，首次调用时注册
+    log_ring *local_ring();
+    char *local_buf();
+    void write_ring(const struct timeval &now, int level, const char *format, va_list valst);
+    void push_ring(const char *buf, size_t len, int level);
+    // 把一条延迟格式化记录渲染成一行文本，返回长度
+    size_t render_record(const log_record_head *head, char *out, size_t cap);
+    size_t render_rings(struct iovec *iov, int cnt, size_t total, long long &lines);
+    void wake_flusher();
+    // 按天或按行数切分日志文件，调用者保证此时没有其他线程写m_fp
+    void roll_file(const struct tm &my_tm);
 
 private:
     char dir_name[128]; //路径名
@@ -68,15 +179,42 @@ private:
     int m_today;        //因为按天分类,记录当前时间是那一天
     FILE *m_fp;         //打开log的文件指针
     char *m_buf;
-    block_queue<string> *m_log_queue; //阻塞队列
+    block_queue<log_line> *m_log_queue; //无锁阻塞队列，槽位中保存格式化好的日志
     bool m_is_async;                  //是否同步标志位
     locker m_mutex;
     int m_close_log; // 日志写入方式
+    int m_level;                 // 最小日志级别
+    int m_flush_policy;          // 刷盘策略
+    int m_flush_interval_ms;     // 按时间刷盘的间隔
+    int m_flush_bytes;           // 按字节数刷盘的阈值
+    size_t m_unflushed;          // 上次刷盘后写入的字节数
+    long long m_last_flush_ms;   // 上次刷盘的时间
+
+    static const int MAX_LOG_THREADS = 256;   // 同时存活的写日志线程各自一个环形缓冲区，超过时共用一个
+    static const int LOG_RENDER_MAX = 4096;   // 单条日志渲染后的最大长度
+    static const int LOG_STAGE_SIZE = 1 << 18; // 延迟格式化时的写盘暂存区
+    bool m_is_ring;                           // 是否使用每线程环形缓冲区
+    bool m_is_deferred;                       // 是否延迟格式化
+    char *m_stage;                            // 刷盘线程的暂存区
+    char *m_render_rec;                       // 刷盘线程解码时拼接记录的缓冲区
+    int m_ring_size;                          // 每个线程环形缓冲区的大小
+    std::atomic<log_ring *> m_rings[MAX_LOG_THREADS];
+    std::atomic<bool> m_ring_idle[MAX_LOG_THREADS]; // 槽位的线程已退出，可以被新线程接手
+    log_ring *m_shared_ring;                  // 槽位用完时各线程加m_mutex共用
+    std::atomic<int> m_ring_count;            // 已注册的环形缓冲区数
+    std::atomic<bool> m_wake_pending;         // 避免生产者重复唤醒刷盘线程
+    sem m_ring_wake;
+    locker m_flush_mutex;                     // 刷盘线程与退出时的最后一次刷盘互斥
+    pthread_t m_flush_tid;                    // 环形缓冲区的刷盘线程
+    bool m_flusher_running;                   // 刷盘线程已启动且还没有被shutdown等待结束
+    std::atomic<bool> m_stopping;             // 通知刷盘线程退出
 };
 
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+//日志宏只负责写入，何时刷盘由刷盘策略决定
+//编译期被裁掉的级别整条语句丢弃，运行期再检查最小级别，都在格式化之前
+#define LOG_DEBUG(format, ...) do { if constexpr (log_compiled(0)) { if (0 == m_close_log && Log::get_instance()->level_enabled(0)) Log::get_instance()->log(0, format, ##__VA_ARGS__); } } while (0)
+#define LOG_INFO(format, ...) do { if constexpr (log_compiled(1)) { if (0 == m_close_log && Log::get_instance()->level_enabled(1)) Log::get_instance()->log(1, format, ##__VA_ARGS__); } } while (0)
+#define LOG_WARN(format, ...) do { if constexpr (log_compiled(2)) { if (0 == m_close_log && Log::get_instance()->level_enabled(2)) Log::get_instance()->log(2, format, ##__VA_ARGS__); } } while (0)
+#define LOG_ERROR(format, ...) do { if constexpr (log_compiled(3)) { if (0 == m_close_log && Log::get_instance()->level_enabled(3)) Log::get_instance()->log(3, format, ##__VA_ARGS__); } } while (0)
 
 #endif
@@ -0,0 +1,113 @@
+/*************************************************************
+*延迟格式化日志记录
+*写日志线程只保存格式串指针和原始参数，格式化交给刷盘线程
+*记录布局: log_record_head + 按参数顺序紧密排列的参数
+*字符串参数会被拷贝进记录，其余参数按值保存
+**************************************************************/
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+// 由模板实例化出的解码函数，把记录中的参数还原后调用snprintf
+typedef int (*log_format_fn)(char *out, size_t cap, const char *format, const char *payload);
+
+struct log_record_head
+{
+    uint32_t len;         // 整条记录长度，包含头部，按8字节对齐
+    uint32_t level;       // 日志级别
+    int64_t usec;         // 写日志时刻，微秒
+    const char *format;   // 格式串，必须是字符串字面量
+    log_format_fn fn;     // 为NULL时payload是已经格式化好的文本
+};
+
+// 算术类型和普通指针按值保存
+template <typename T, typename Enable = void>
+struct log_arg_codec
+{
+    static_assert(std::is_trivially_copyable<T>::value, "log argument must be trivially copyable");
+    typedef T value_type;
+    static size_t size(const T &)
+    {
+        return sizeof(T);
+    }
+    static char *encode(char *p, const T &v)
+    {
+        memcpy(p, &v, sizeof(T));
+        return p + sizeof(T);
+    }
+    static T decode(const char *&p)
+    {
+        T v;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+};
+
+// 字符串参数在写日志之后可能失效，拷贝内容，解码时直接指向记录内部
+template <typename T>
+struct log_arg_codec<T, typename std::enable_if<std::is_same<T, const char *>::value || std::is_same<T, char *>::value>::type>
+{
+    typedef const char *value_type;
+    static size_t size(const char *v)
+    {
+        return sizeof(uint32_t) + (v ? strlen(v) : 6) + 1;
+    }
+    static char *encode(char *p, const char *v)
+    {
+        if (!v)
+            v = "(null)";
+        uint32_t n = strlen(v);
+        memcpy(p, &n, sizeof(n));
+        memcpy(p + sizeof(n), v, n + 1);
+        return p + sizeof(n) + n + 1;
+    }
+    static const char *decode(const char *&p)
+    {
+        uint32_t n;
+        memcpy(&n, p, sizeof(n));
+        const char *v = p + sizeof(n);
+        p += sizeof(n) + n + 1;
+        return v;
+    }
+};
+
+template <typename... Args>
+int log_format_record(char *out, size_t cap, const char *format, const char *payload)
+{
+    const char *p = payload;
+    // 花括号初始化保证参数按从左到右的顺序解码
+    std::tuple<typename log_arg_codec<Args>::value_type...> args{log_arg_codec<Args>::decode(p)...};
+    (void)p;
+    return std::apply([&](auto... a) { return snprintf(out, cap, format, a...); }, args);
+}
+
+template <typename... Args>
+size_t log_record_size(const Args &... args)
+{
+    size_t len = sizeof(log_record_head) + (log_arg_codec<Args>::size(args) + ... + 0);
+    return (len + 7) & ~(size_t)7;
+}
+
+// 把参数编码到buf中，buf至少有log_record_size()字节
+template <typename... Args>
+void log_record_encode(char *buf, size_t len, int level, int64_t usec, const char *format, const Args &... args)
+{
+    log_record_head *head = (log_record_head *)buf;
+    head->len = len;
+    head->level = level;
+    head->usec = usec;
+    head->format = format;
+    head->fn = log_format_record<Args...>;
+    char *p = buf + sizeof(log_record_head);
+    ((p = log_arg_codec<Args>::encode(p, args)), ...);
+    (void)p;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*************************************************************
+*每个写日志线程独占一个单生产者/单消费者字节环形缓冲区
+*生产者只推进m_head，刷盘线程只推进m_tail，两端都不需要加锁
+**************************************************************/
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+
+class log_ring
+{
+public:
+    // size会被向上取整为2的幂
+    explicit log_ring(size_t size)
+    {
+        size_t cap = 4096;
+        while (cap < size)
+            cap <<= 1;
+        m_buf = new char[cap];
+        m_mask = cap - 1;
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~log_ring()
+    {
+        delete[] m_buf;
+    }
+
+    log_ring(const log_ring &) = delete;
+    log_ring &operator=(const log_ring &) = delete;
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    // 已写入但还未被刷盘线程取走的字节数
+    size_t used() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    // 生产者：整条写入，剩余空间不足时返回false，不会写入半条日志
+    bool push(const char *data, size_t len)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        if (len > capacity() - (head - tail))
+            return false;
+
+        size_t pos = head & m_mask;
+        size_t first = capacity() - pos;
+        if (first >= len)
+        {
+            memcpy(m_buf + pos, data, len);
+        }
+        else
+        {
+            memcpy(m_buf + pos, data, first);
+            memcpy(m_buf, data + first, len - first);
+        }
+        m_head.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者：取出当前可读区域，环绕时为两段，返回总字节数
+    size_t peek(struct iovec *iov, int &cnt) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t len = head - tail;
+        cnt = 0;
+        if (len == 0)
+            return 0;
+
+        size_t pos = tail & m_mask;
+        size_t first = capacity() - pos;
+        if (first >= len)
+        {
+            iov[cnt].iov_base = m_buf + pos;
+            iov[cnt++].iov_len = len;
+        }
+        else
+        {
+            iov[cnt].iov_base = m_buf + pos;
+            iov[cnt++].iov_len = first;
+            iov[cnt].iov_base = m_buf;
+            iov[cnt++].iov_len = len - first;
+        }
+        return len;
+    }
+
+    // 消费者：写盘完成后归还空间
+    void consume(size_t len)
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+private:
+    char *m_buf;
+    size_t m_mask;
+    // 读写位置分别放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_head; // 生产者写位置
+    alignas(64) std::atomic<size_t> m_tail; // 刷盘线程读位置
+};
+
+#endif
@@ -16,13 +16,60 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.log_level, config.log_flush, config.queue_wait,
+                config.access_log, config.trace_threshold, config.credential,
+                config.accept_budget, config.backlog, config.tcp_profile, config.compress_cache,
+                config.autoindex, config.large_file, config.queue_target, config.db_limit, config.rate_limit);
     
 
+    //动态接口，在线程池中执行，不经过文件系统
+    http_conn::add_handler(ROUTE_GET, "/api/health", [](const request_view &, response_builder &res) {
+        res.type("application/json");
+        res.header("Cache-Control", "no-store");
+        res.printf("{\"status\":\"ok\",\"connections\":%d}", http_conn::m_user_count.load());
+    });
+
+    //协程接口，等待期间不占用工作线程，例如/api/delay?ms=200
+    http_conn::add_coro_handler(ROUTE_GET, "/api/delay", [](const request_view &req, response_builder &res) -> coro_task {
+        const char *ms = strstr(req.query, "ms=");
+        int delay = ms ? atoi(ms + 3) : 100;
+        if (delay < 0 || delay > 10000)
+            delay = 100;
+        co_await coro_sleep(delay);
+        res.type("application/json");
+        res.printf("{\"delay_ms\":%d}", delay);
+    });
+    //注册在阻塞线程里执行，mysql后端会写数据库
+    http_conn::add_coro_handler(ROUTE_POST, "/api/register", [](const request_view &req, response_builder &res) -> coro_task {
+        const char *user = req.form("user");
+        const char *password = req.form("password");
+        res.type("application/json");
+        if (!user || !password)
+        {
+            res.status(400);
+            res.write("{\"registered\":false}");
+            co_return;
+        }
+        // 同时写数据库的太多时直接拒绝，名额一直占到协程结束
+        db_ticket ticket;
+        if (!ticket)
+        {
+            res.status(503);
+            res.header("Retry-After", "1");
+            res.write("{\"registered\":false}");
+            co_return;
+        }
+        std::string name = user, passwd = password;
+        bool ok = false;
+        co_await coro_blocking([&] { ok = http_conn::m_credentials->add_user(name, passwd); });
+        res.status(ok ? 201 : 409);
+        res.printf("{\"registered\":%s}", ok ? "true" : "false");
+    });
+
     //日志
     server.log_write();
 
-    //数据库
+    //凭据存储，mysql后端会初始化数据库连接池
     server.sql_pool();
 
     //线程池
@@ -37,5 +84,8 @@ int main(int argc, char *argv[])
     //运行
     server.eventLoop();
 
+    //退出前写完剩余的日志
+    Log::get_instance()->shutdown();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*************************************************************
+*对数-线性分桶的延迟直方图(HDR histogram的简化版)
+*每个2的幂区间再等分16个子桶，相对误差不超过1/16
+*单线程写：计数用relaxed原子读写，不用原子加，抓取线程随时可以并发读
+**************************************************************/
+
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+class hdr_histogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;      // 小于32的值每个值一个桶
+    static const int HALF_COUNT = SUB_COUNT / 2;     // 之后每个2的幂区间16个桶
+    static const int MAX_EXP = 40;                   // 纳秒计约1100秒，更大的值落在最后一个桶
+    static const int BUCKETS = SUB_COUNT + (MAX_EXP - SUB_BITS + 1) * HALF_COUNT;
+
+    hdr_histogram()
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+            m_counts[i].store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+    }
+
+    static int index(uint64_t v)
+    {
+        if (v < (uint64_t)SUB_COUNT)
+            return v;
+        int e = 63 - __builtin_clzll(v);
+        if (e > MAX_EXP)
+            return BUCKETS - 1;
+        return SUB_COUNT + (e - SUB_BITS) * HALF_COUNT + (int)((v >> (e - SUB_BITS + 1)) - HALF_COUNT);
+    }
+
+    // 桶内的最大值，报告分位数时取它，结果偏大不偏小
+    static uint64_t upper_bound(int idx)
+    {
+        if (idx < SUB_COUNT)
+            return idx;
+        int k = idx - SUB_COUNT;
+        int shift = k / HALF_COUNT + 1;
+        uint64_t m = k % HALF_COUNT + HALF_COUNT;
+        return ((m + 1) << shift) - 1;
+    }
+
+    // 只能由拥有者线程调用
+    void record(uint64_t v)
+    {
+        std::atomic<uint64_t> &c = m_counts[index(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    // 累加到counts中，抓取时合并各线程的直方图
+    void merge_into(uint64_t *counts, uint64_t &sum) const
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+            counts[i] += m_counts[i].load(std::memory_order_relaxed);
+        sum += m_sum.load(std::memory_order_relaxed);
+    }
+
+    // 在合并好的计数上求分位数
+    static uint64_t quantile(const uint64_t *counts, uint64_t total, double q)
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return upper_bound(i);
+        }
+        return upper_bound(BUCKETS - 1);
+    }
+
+private:
+    std::atomic<uint64_t> m_counts[BUCKETS];
+    std::atomic<uint64_t> m_sum;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "metrics.h"
+
+// 单独计数的状态码，其余归入other
+static const int STATUS_CODES[] = {200, 206, 304, 400, 403, 404, 416, 429, 500, 503};
+static const int STATUS_CODE_COUNT = sizeof(STATUS_CODES) / sizeof(STATUS_CODES[0]);
+static_assert(METRIC_STATUS_BASE + STATUS_CODE_COUNT == METRIC_STATUS_OTHER, "STATUS_CODES out of sync with METRIC_COUNTER");
+// 与threadpool/admission.h中的SHED_REASON一致
+static const char *SHED_REASONS[] = {"queue", "db", "queue_full", "connections"};
+static_assert(sizeof(SHED_REASONS) / sizeof(SHED_REASONS[0]) == METRIC_SHED_END - METRIC_SHED_BASE, "SHED_REASONS out of sync with METRIC_COUNTER");
+
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+struct histogram_info
+{
+    const char *name;
+    const char *help;
+};
+
+static const histogram_info HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+    {"tinywebserver_parse_seconds", "Time spent parsing a request and locating the resource."},
+    {"tinywebserver_write_seconds", "Time from response ready to last byte sent."},
+    {"tinywebserver_db_wait_seconds", "Time spent waiting for a database connection."},
+    {"tinywebserver_request_seconds", "Time from first request byte to last response byte."},
+    {"tinywebserver_queue_seconds", "Time spent waiting in the thread pool queue."},
+};
+
+thread_local metrics_shard *metrics::t_shard = NULL;
+
+metrics::metrics()
+{
+    for (int i = 0; i < MAX_METRIC_THREADS; ++i)
+        m_shards[i].store(NULL);
+    m_shard_count.store(0);
+    m_overflow = new metrics_shard();
+    for (int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+        m_overflow->counters[i].store(0);
+    for (int i = 0; i < METRIC_GAUGE_COUNT; ++i)
+        m_gauges[i].store(0);
+}
+
+metrics_shard *metrics::register_shard()
+{
+    int idx = m_shard_count.fetch_add(1);
+    if (idx >= MAX_METRIC_THREADS)
+    {
+        t_shard = m_overflow;
+        return t_shard;
+    }
+    // 线程退出后分片仍保留，已记录的数据不丢
+    metrics_shard *shard = new metrics_shard();
+    for (int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+        shard->counters[i].store(0, std::memory_order_relaxed);
+    m_shards[idx].store(shard, std::memory_order_release);
+    t_shard = shard;
+    return shard;
+}
+
+int metrics::status_index(int status)
+{
+    for (int i = 0; i < STATUS_CODE_COUNT; ++i)
+    {
+        if (STATUS_CODES[i] == status)
+            return i;
+    }
+    return STATUS_CODE_COUNT;
+}
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+std::string metrics::render()
+{
+    // 合并各线程分片
+    uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+    static thread_local uint64_t buckets[METRIC_HISTOGRAM_COUNT][hdr_histogram::BUCKETS];
+    uint64_t sums[METRIC_HISTOGRAM_COUNT] = {0};
+    memset(buckets, 0, sizeof(buckets));
+
+    int n = m_shard_count.load(std::memory_order_acquire);
+    if (n > MAX_METRIC_THREADS)
+        n = MAX_METRIC_THREADS;
+    for (int i = 0; i <= n; ++i)
+    {
+        metrics_shard *shard = i < n ? m_shards[i].load(std::memory_order_acquire) : m_overflow;
+        // 计数已经加过但分片还没发布
+        if (shard == NULL)
+            continue;
+        for (int c = 0; c < METRIC_COUNTER_COUNT; ++c)
+            counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+            shard->histograms[h].merge_into(buckets[h], sums[h]);
+    }
+
+    std::string out;
+    out.reserve(4096);
+    append(out, "# HELP tinywebserver_accepts_total Accepted connections.\n"
+                "# TYPE tinywebserver_accepts_total counter\n"
+                "tinywebserver_accepts_total %llu\n",
+           (unsigned long long)counters[METRIC_ACCEPTS]);
+
+    out += "# HELP tinywebserver_requests_total Responses sent, by status code.\n"
+           "# TYPE tinywebserver_requests_total counter\n";
+    for (int i = 0; i < STATUS_CODE_COUNT; ++i)
+        append(out, "tinywebserver_requests_total{status=\"%d\"} %llu\n", STATUS_CODES[i],
+               (unsigned long long)counters[METRIC_STATUS_BASE + i]);
+    append(out, "tinywebserver_requests_total{status=\"other\"} %llu\n", (unsigned long long)counters[METRIC_STATUS_OTHER]);
+
+    out += "# HELP tinywebserver_shed_total Requests rejected with 503 by admission control, by reason.\n"
+           "# TYPE tinywebserver_shed_total counter\n";
+    for (int i = 0; i < METRIC_SHED_END - METRIC_SHED_BASE; ++i)
+        append(out, "tinywebserver_shed_total{reason=\"%s\"} %llu\n", SHED_REASONS[i],
+               (unsigned long long)counters[METRIC_SHED_BASE + i]);
+
+    append(out, "# HELP tinywebserver_response_bytes_total Response bytes sent, headers included.\n"
+                "# TYPE tinywebserver_response_bytes_total counter\n"
+                "tinywebserver_response_bytes_total %llu\n",
+           (unsigned long long)counters[METRIC_BYTES_SENT]);
+
+    append(out, "# HELP tinywebserver_epoll_ctl_total epoll_ctl calls made for client connections.\n"
+                "# TYPE tinywebserver_epoll_ctl_total counter\n"
+                "tinywebserver_epoll_ctl_total %llu\n",
+           (unsigned long long)counters[METRIC_EPOLL_CTL]);
+
+    append(out, "# HELP tinywebserver_compress_total Compressed responses, by whether the body was already compressed.\n"
+                "# TYPE tinywebserver_compress_total counter\n"
+                "tinywebserver_compress_total{cache=\"hit\"} %llu\n"
+                "tinywebserver_compress_total{cache=\"miss\"} %llu\n",
+           (unsigned long long)counters[METRIC_COMPRESS_HIT], (unsigned long long)counters[METRIC_COMPRESS_MISS]);
+
+    append(out, "# HELP tinywebserver_connections Open client connections.\n"
+                "# TYPE tinywebserver_connections gauge\n"
+                "tinywebserver_connections %ld\n",
+           m_gauges[METRIC_CONNECTIONS].load(std::memory_order_relaxed));
+    append(out, "# HELP tinywebserver_threadpool_queue_depth Requests waiting in the thread pool queue.\n"
+                "# TYPE tinywebserver_threadpool_queue_depth gauge\n"
+                "tinywebserver_threadpool_queue_depth %ld\n",
+           m_gauges[METRIC_QUEUE_DEPTH].load(std::memory_order_relaxed));
+
+    // 直方图在服务端已经合并成精确分位数，按summary输出
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+    {
+        const char *name = HISTOGRAMS[h].name;
+        uint64_t total = 0;
+        for (int i = 0; i < hdr_histogram::BUCKETS; ++i)
+            total += buckets[h][i];
+        append(out, "# HELP %s %s\n# TYPE %s summary\n", name, HISTOGRAMS[h].help, name);
+        for (size_t q = 0; q < sizeof(QUANTILES) / sizeof(QUANTILES[0]); ++q)
+            append(out, "%s{quantile=\"%g\"} %.9f\n", name, QUANTILES[q],
+                   hdr_histogram::quantile(buckets[h], total, QUANTILES[q]) / 1e9);
+        append(out, "%s_sum %.9f\n%s_count %llu\n", name, sums[h] / 1e9, name, (unsigned long long)total);
+    }
+    return out;
+}
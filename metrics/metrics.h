@@ -0,0 +1,123 @@
+/*************************************************************
+*运行指标
+*每个线程写自己的计数器和延迟直方图，记录时没有原子加、没有锁
+*请求/metrics时合并所有线程的数据，输出Prometheus文本格式
+**************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include "hdr_histogram.h"
+
+// 计数器，只增不减
+enum METRIC_COUNTER
+{
+    METRIC_ACCEPTS = 0,   // 接受的连接数
+    METRIC_BYTES_SENT,    // 发送的响应字节数
+    METRIC_EPOLL_CTL,     // 连接上的epoll_ctl调用次数
+    METRIC_COMPRESS_HIT,  // 压缩响应体缓存命中，含预压缩文件
+    METRIC_COMPRESS_MISS, // 压缩响应体缓存未命中，需要即时压缩
+    METRIC_STATUS_BASE,   // 以下按状态码计数，顺序与metrics.cpp中的STATUS_CODES一致
+    METRIC_STATUS_OTHER = METRIC_STATUS_BASE + 10,
+    METRIC_SHED_BASE,     // 以下按原因计数准入控制拒绝的请求，顺序与SHED_REASON一致
+    METRIC_SHED_END = METRIC_SHED_BASE + 4,
+    METRIC_COUNTER_COUNT = METRIC_SHED_END
+};
+
+// 延迟直方图，单位纳秒
+enum METRIC_HISTOGRAM
+{
+    METRIC_PARSE = 0, // 解析请求并定位资源
+    METRIC_WRITE,     // 响应生成后到最后一个字节发出
+    METRIC_DB_WAIT,   // 等待数据库连接
+    METRIC_REQUEST,   // 收到第一个字节到响应发完
+    METRIC_QUEUE,     // 在线程池请求队列里等待
+    METRIC_HISTOGRAM_COUNT
+};
+
+// 瞬时值，由拥有者直接覆盖
+enum METRIC_GAUGE
+{
+    METRIC_CONNECTIONS = 0, // 当前连接数
+    METRIC_QUEUE_DEPTH,     // 线程池请求队列长度
+    METRIC_GAUGE_COUNT
+};
+
+// 每个线程一份，按缓存行对齐避免伪共享
+struct alignas(64) metrics_shard
+{
+    std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+    hdr_histogram histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+class metrics
+{
+public:
+    static metrics *get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    static int64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    void count(int counter, uint64_t n = 1)
+    {
+        std::atomic<uint64_t> &c = local()->counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void count_status(int status)
+    {
+        count(METRIC_STATUS_BASE + status_index(status));
+    }
+
+    void observe(int histogram, uint64_t ns)
+    {
+        local()->histograms[histogram].record(ns);
+    }
+
+    void set_gauge(int gauge, long value)
+    {
+        m_gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    // 合并所有线程的数据，输出Prometheus文本格式
+    std::string render();
+
+    static const int MAX_METRIC_THREADS = 256;
+
+private:
+    metrics();
+    ~metrics() {}
+    metrics(const metrics &) = delete;
+    metrics &operator=(const metrics &) = delete;
+
+    metrics_shard *local()
+    {
+        if (t_shard)
+            return t_shard;
+        return register_shard();
+    }
+    metrics_shard *register_shard();
+    static int status_index(int status);
+
+private:
+    static thread_local metrics_shard *t_shard;
+    std::atomic<metrics_shard *> m_shards[MAX_METRIC_THREADS];
+    std::atomic<int> m_shard_count;
+    // 线程数超过上限时共用，计数可能丢失但不会出错
+    metrics_shard *m_overflow;
+    std::atomic<long> m_gauges[METRIC_GAUGE_COUNT];
+};
+
+#endif
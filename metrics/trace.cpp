@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+bool tracer::s_enabled = false;
+
+// 导出时由阶段时间戳拼出的区间，区间画在起点阶段所在的线程上
+struct trace_span
+{
+    const char *name;
+    int begin;
+    int end;
+};
+
+static const trace_span SPANS[] = {
+    {"dispatch", TRACE_EPOLL, TRACE_ENQUEUE},
+    {"read", TRACE_READ_START, TRACE_READ_END},
+    {"queue", TRACE_ENQUEUE, TRACE_DEQUEUE},
+    {"credential", TRACE_DB_START, TRACE_DB_END},
+    {"parse", TRACE_PARSE_START, TRACE_PARSE_END},
+    {"fs", TRACE_FS_START, TRACE_FS_END},
+    {"write", TRACE_WRITE_START, TRACE_WRITE_END},
+};
+
+tracer::tracer()
+{
+    m_threshold_ticks = 0;
+    m_ns_per_tick = 1;
+    m_base_ticks = 0;
+    m_base_ns = 0;
+    m_ring = NULL;
+    m_capacity = 0;
+    m_written = 0;
+}
+
+tracer::~tracer()
+{
+    s_enabled = false;
+    delete[] m_ring;
+}
+
+static double raw_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// TSC频率用CLOCK_MONOTONIC_RAW标定一次，之后只做乘法
+void tracer::calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    double ns0 = raw_ns();
+    uint64_t t0 = now();
+    usleep(20000);
+    double ns1 = raw_ns();
+    uint64_t t1 = now();
+    m_ns_per_tick = (ns1 - ns0) / (double)(t1 - t0);
+    m_base_ticks = t0;
+    m_base_ns = ns0;
+#else
+    m_ns_per_tick = 1;
+    m_base_ticks = 0;
+    m_base_ns = 0;
+#endif
+}
+
+void tracer::init(int threshold_us, int capacity)
+{
+    if (threshold_us <= 0 || capacity <= 0)
+        return;
+    calibrate();
+    m_threshold_ticks = (uint64_t)(threshold_us * 1000.0 / m_ns_per_tick);
+    m_capacity = capacity;
+    m_ring = new slow_trace[capacity];
+    s_enabled = true;
+}
+
+uint32_t tracer::thread_id()
+{
+    static thread_local uint32_t t_tid = 0;
+    if (0 == t_tid)
+        t_tid = syscall(SYS_gettid);
+    return t_tid;
+}
+
+void tracer::finish(const record &rec, int fd, const char *url, int status)
+{
+    if (!s_enabled || 0 == rec.ts[TRACE_WRITE_END])
+        return;
+    uint64_t start = rec.ts[TRACE_WRITE_END];
+    for (int i = 0; i < TRACE_PHASE_COUNT; ++i)
+    {
+        if (rec.ts[i] && rec.ts[i] < start)
+            start = rec.ts[i];
+    }
+    if (rec.ts[TRACE_WRITE_END] - start < m_threshold_ticks)
+        return;
+
+    // 只有慢请求走到这里，加锁的代价可以忽略
+    m_mutex.lock();
+    slow_trace &slot = m_ring[m_written % m_capacity];
+    slot.rec = rec;
+    slot.fd = fd;
+    slot.status = status;
+    snprintf(slot.url, sizeof(slot.url), "%s", url ? url : "-");
+    m_written++;
+    m_mutex.unlock();
+}
+
+static void append_json_string(std::string &out, const char *s)
+{
+    out += '"';
+    for (; *s; ++s)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+std::string tracer::dump_chrome()
+{
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    if (!s_enabled)
+        return out + "]}";
+
+    int pid = getpid();
+    bool first = true;
+    char buf[256];
+    m_mutex.lock();
+    uint64_t begin = m_written > (uint64_t)m_capacity ? m_written - m_capacity : 0;
+    for (uint64_t n = begin; n < m_written; ++n)
+    {
+        const slow_trace &t = m_ring[n % m_capacity];
+        const record &rec = t.rec;
+        int start_phase = TRACE_WRITE_END;
+        for (int i = 0; i < TRACE_PHASE_COUNT; ++i)
+        {
+            if (rec.ts[i] && rec.ts[i] < rec.ts[start_phase])
+                start_phase = i;
+        }
+
+        // 整个请求一个区间，参数里带上url、状态码和fd，各阶段嵌套在下面
+        double ts = to_ns(rec.ts[start_phase]) / 1000.0;
+        double dur = (to_ns(rec.ts[TRACE_WRITE_END]) - to_ns(rec.ts[start_phase])) / 1000.0;
+        snprintf(buf, sizeof(buf), "%s{\"name\":\"request\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+                                   "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"fd\":%d,\"status\":%d,\"url\":",
+                 first ? "" : ",", pid, rec.tid[start_phase], ts, dur, t.fd, t.status);
+        out += buf;
+        append_json_string(out, t.url);
+        out += "}}";
+        first = false;
+
+        for (size_t s = 0; s < sizeof(SPANS) / sizeof(SPANS[0]); ++s)
+        {
+            uint64_t b = rec.ts[SPANS[s].begin];
+            uint64_t e = rec.ts[SPANS[s].end];
+            if (0 == b || 0 == e || e < b)
+                continue;
+            snprintf(buf, sizeof(buf), ",{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                     SPANS[s].name, pid, rec.tid[SPANS[s].begin], to_ns(b) / 1000.0, (to_ns(e) - to_ns(b)) / 1000.0);
+            out += buf;
+        }
+    }
+    m_mutex.unlock();
+    return out + "]}";
+}
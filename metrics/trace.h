@@ -0,0 +1,146 @@
+/*************************************************************
+*请求分阶段追踪
+*每个连接带一条追踪记录，热点路径上按阶段打时间戳(x86用rdtsc，其余平台用CLOCK_MONOTONIC_RAW)
+*响应发完后总耗时超过阈值的记录拷贝进慢请求环形缓冲区，可以导出为Chrome trace JSON
+*未开启时每个打点只是一次分支判断
+**************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "../lock/locker.h"
+
+// 阶段时间戳，*_START只记第一次，*_END记最后一次，跨多次读写时覆盖整个过程
+enum TRACE_PHASE
+{
+    TRACE_EPOLL = 0,   // 主线程从epoll_wait拿到读事件
+    TRACE_READ_START,  // 开始读socket
+    TRACE_READ_END,
+    TRACE_ENQUEUE,     // 放入线程池队列
+    TRACE_DEQUEUE,     // 工作线程取出
+    TRACE_DB_START,    // 凭据存储的登录校验或注册，包含等待数据库连接
+    TRACE_DB_END,
+    TRACE_PARSE_START, // process_read，包含do_request
+    TRACE_PARSE_END,
+    TRACE_FS_START,    // do_request中的stat/open/mmap
+    TRACE_FS_END,
+    TRACE_WRITE_START, // 第一次写socket
+    TRACE_WRITE_END,   // 最后一个字节发出
+    TRACE_PHASE_COUNT
+};
+
+class tracer
+{
+public:
+    static tracer *get_instance()
+    {
+        static tracer instance;
+        return &instance;
+    }
+
+    // threshold_us为慢请求阈值，capacity为保留的慢请求条数
+    void init(int threshold_us, int capacity = 1024);
+
+    static bool enabled()
+    {
+        return s_enabled;
+    }
+
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+    }
+
+    // 线程id，每个线程只取一次
+    static uint32_t thread_id();
+
+    // 时间戳换算成CLOCK_MONOTONIC_RAW纳秒
+    double to_ns(uint64_t ticks) const
+    {
+        return m_base_ns + ((double)ticks - (double)m_base_ticks) * m_ns_per_tick;
+    }
+
+    struct record;
+    // 响应发完时调用，超过阈值则保存
+    void finish(const record &rec, int fd, const char *url, int status);
+
+    // 导出所有保存的慢请求
+    std::string dump_chrome();
+
+public:
+    struct record
+    {
+        uint64_t ts[TRACE_PHASE_COUNT];
+        uint32_t tid[TRACE_PHASE_COUNT];
+    };
+
+private:
+    tracer();
+    ~tracer();
+    tracer(const tracer &) = delete;
+    tracer &operator=(const tracer &) = delete;
+
+    void calibrate();
+
+    struct slow_trace
+    {
+        record rec;
+        int fd;
+        int status;
+        char url[64];
+    };
+
+private:
+    static bool s_enabled;
+    uint64_t m_threshold_ticks;
+    double m_ns_per_tick;
+    uint64_t m_base_ticks;
+    double m_base_ns;
+
+    slow_trace *m_ring;
+    int m_capacity;
+    uint64_t m_written;
+    locker m_mutex;
+};
+
+// 每个连接一条，随连接复用
+struct request_trace
+{
+    tracer::record rec;
+
+    void reset()
+    {
+        if (tracer::enabled())
+            memset(&rec, 0, sizeof(rec));
+    }
+
+    void begin(int phase)
+    {
+        if (tracer::enabled() && 0 == rec.ts[phase])
+            stamp(phase);
+    }
+
+    void end(int phase)
+    {
+        if (tracer::enabled())
+            stamp(phase);
+    }
+
+    void stamp(int phase)
+    {
+        rec.ts[phase] = tracer::now();
+        rec.tid[phase] = tracer::thread_id();
+    }
+};
+
+#endif
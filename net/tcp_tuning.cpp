@@ -0,0 +1,85 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "tcp_tuning.h"
+#include "../log/log.h"
+
+static const char *PROFILE_NAMES[TCP_PROFILE_COUNT] = {"default", "latency", "throughput"};
+
+tcp_tuning::tcp_tuning()
+{
+    init(TCP_PROFILE_DEFAULT, 1);
+}
+
+void tcp_tuning::init(int profile, int close_log)
+{
+    m_close_log = close_log;
+    if (profile < 0 || profile >= TCP_PROFILE_COUNT)
+        profile = TCP_PROFILE_DEFAULT;
+    this->profile = profile;
+    // 0表示不设置，沿用系统默认
+    nodelay = 0;
+    defer_accept = 0;
+    fastopen = 0;
+    sndbuf = 0;
+    rcvbuf = 0;
+    notsent_lowat = 0;
+    quickack = 0;
+
+    if (TCP_PROFILE_LATENCY == profile)
+    {
+        // 响应头和正文分两次写时不等前一段的ACK
+        nodelay = 1;
+        // 只连不发的连接留在内核里，不占用http_conn和定时器
+        defer_accept = 1;
+        fastopen = 256;
+        // 发送队列只留一小段，可写通知更及时，内存也少
+        notsent_lowat = 16 * 1024;
+        quickack = 1;
+    }
+    else if (TCP_PROFILE_THROUGHPUT == profile)
+    {
+        nodelay = 1;
+        defer_accept = 1;
+        // 大文件一次writev/sendfile能塞进更多数据，减少EPOLLOUT往返
+        sndbuf = 4 * 1024 * 1024;
+        rcvbuf = 256 * 1024;
+    }
+}
+
+const char *tcp_tuning::name(int profile)
+{
+    if (profile < 0 || profile >= TCP_PROFILE_COUNT)
+        return "unknown";
+    return PROFILE_NAMES[profile];
+}
+
+static bool set_opt(int fd, int level, int opt, int val)
+{
+    return setsockopt(fd, level, opt, &val, sizeof(val)) == 0;
+}
+
+void tcp_tuning::apply_listen(int fd)
+{
+    // Linux上NODELAY、NOTSENT_LOWAT和缓冲区大小会被accept出来的连接继承，只需要在监听socket上设置一次
+    if (nodelay && !set_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1))
+        LOG_WARN("setsockopt TCP_NODELAY failed");
+    if (sndbuf && !set_opt(fd, SOL_SOCKET, SO_SNDBUF, sndbuf))
+        LOG_WARN("setsockopt SO_SNDBUF failed");
+    if (rcvbuf && !set_opt(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf))
+        LOG_WARN("setsockopt SO_RCVBUF failed");
+    if (notsent_lowat && !set_opt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat))
+        LOG_WARN("setsockopt TCP_NOTSENT_LOWAT failed");
+    if (defer_accept && !set_opt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept))
+        LOG_WARN("setsockopt TCP_DEFER_ACCEPT failed");
+    // 内核没打开TFO时失败，不影响普通连接
+    if (fastopen && !set_opt(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen))
+        LOG_WARN("setsockopt TCP_FASTOPEN failed");
+}
+
+void tcp_tuning::apply_conn(int fd)
+{
+    // QUICKACK不是持久的，内核会在之后的交互中自己切回延迟确认
+    if (quickack)
+        set_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+}
@@ -0,0 +1,48 @@
+/*************************************************************
+*TCP调优配置
+*按-P选择一组socket选项，分别作用在监听socket和accept出来的连接上
+*0保持系统默认；1偏向首字节延迟；2偏向大文件吞吐
+**************************************************************/
+
+#ifndef TCP_TUNING_H
+#define TCP_TUNING_H
+
+enum TCP_PROFILE
+{
+    TCP_PROFILE_DEFAULT = 0,
+    TCP_PROFILE_LATENCY,
+    TCP_PROFILE_THROUGHPUT,
+    TCP_PROFILE_COUNT
+};
+
+class tcp_tuning
+{
+public:
+    tcp_tuning();
+
+    // 按配置号填充各选项，超出范围时退回默认
+    void init(int profile, int close_log);
+
+    // listen之前调用，缓冲区大小要在listen之前设置才会用于三次握手的窗口协商
+    void apply_listen(int fd);
+
+    // accept之后调用，只设置不会从监听socket继承的选项，目前只有QUICKACK
+    void apply_conn(int fd);
+
+    static const char *name(int profile);
+
+public:
+    int profile;
+    int nodelay;       // TCP_NODELAY，关闭Nagle
+    int defer_accept;  // TCP_DEFER_ACCEPT，秒，客户端发来数据后才算accept就绪
+    int fastopen;      // TCP_FASTOPEN，TFO请求队列长度，需要net.ipv4.tcp_fastopen打开服务端
+    int sndbuf;        // SO_SNDBUF，字节，设置后内核不再自动调节
+    int rcvbuf;        // SO_RCVBUF，字节
+    int notsent_lowat; // TCP_NOTSENT_LOWAT，未发送数据低于该值才可写
+    int quickack;      // TCP_QUICKACK，连接建立后立即确认
+
+private:
+    int m_close_log;
+};
+
+#endif
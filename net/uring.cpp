@@ -0,0 +1,354 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include "uring.h"
+
+uring::uring()
+{
+    m_ring_fd = -1;
+    m_sq_ptr = m_cq_ptr = NULL;
+    m_sqes = NULL;
+    m_to_submit = 0;
+    m_gen = NULL;
+    m_max_fd = 0;
+    m_wake_fd = -1;
+    m_wake_buf = 0;
+    m_enter_calls = 0;
+}
+
+uring::~uring()
+{
+    if (m_ring_fd < 0)
+        return;
+    munmap(m_sqes, m_sqes_len);
+    if (m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_len);
+    munmap(m_sq_ptr, m_sq_len);
+    close(m_ring_fd);
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+    delete[] m_gen;
+}
+
+bool uring::init(unsigned entries, int max_fd)
+{
+    // 多发accept要5.19，多发poll要5.13，都没有对应的特性位，先在一个临时的环上试一次
+    {
+        uring probe;
+        if (!probe.setup(2) || !probe.probe_multishot())
+            return false;
+    }
+    if (!setup(entries))
+        return false;
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_gen = new std::atomic<uint32_t>[max_fd];
+    for (int i = 0; i < max_fd; ++i)
+        m_gen[i] = 0;
+    m_max_fd = max_fd;
+    m_owner = pthread_self();
+    return true;
+}
+
+bool uring::setup(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 只有主线程提交，完成事件也只在主线程等待时处理，省去内核的跨线程通知
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0 && errno == EINVAL)
+    {
+        // 6.1之前的内核不支持上面两个标志
+        memset(&p, 0, sizeof(p));
+        fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (fd < 0)
+        return false;
+    // 需要单次mmap和带超时的等待，5.11之后都有
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG))
+    {
+        close(fd);
+        return false;
+    }
+
+    m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (m_cq_len > m_sq_len)
+        m_sq_len = m_cq_len;
+    m_cq_len = m_sq_len;
+    m_sq_ptr = mmap(NULL, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    m_cq_ptr = m_sq_ptr;
+    m_sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        munmap(m_sq_ptr, m_sq_len);
+        close(fd);
+        return false;
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    m_sq_entries = p.sq_entries;
+    m_ring_fd = fd;
+    return true;
+}
+
+bool uring::probe_multishot()
+{
+    // 只给地址族时绑定到内核分配的抽象地址；先连上一个，poll和accept都能立即完成
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int cfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    socklen_t len = sizeof(addr);
+    bool ok = lfd >= 0 && cfd >= 0 && 0 == bind(lfd, (struct sockaddr *)&addr, sizeof(sa_family_t)) &&
+              0 == listen(lfd, 1) && 0 == getsockname(lfd, (struct sockaddr *)&addr, &len) &&
+              0 == connect(cfd, (struct sockaddr *)&addr, len);
+    int more = 0;
+    // poll排在前面，在accept取走连接之前看到监听socket可读
+    if (ok && prep_poll(lfd, URING_SIGNAL) && prep_accept(lfd))
+    {
+        // 不支持的内核在提交时就以EINVAL完成，支持的带着IORING_CQE_F_MORE继续等待
+        for (int i = 0; i < 2 && more >= 0 && more < 2; ++i)
+        {
+            if (submit_and_wait(1000) < 0)
+                break;
+            struct io_uring_cqe *cqe;
+            while ((cqe = peek()) != NULL)
+            {
+                if (URING_ACCEPT == op_of(cqe->user_data) && cqe->res >= 0)
+                    close(cqe->res);
+                if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_MORE))
+                    ++more;
+                else
+                    more = -1;
+                cqe_seen();
+            }
+        }
+    }
+    // 还挂着的多发请求在临时的环关闭时由内核取消
+    if (lfd >= 0)
+        close(lfd);
+    if (cfd >= 0)
+        close(cfd);
+    return 2 == more;
+}
+
+int uring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    ++m_enter_calls;
+    return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+bool uring::reserve(unsigned n)
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *m_sq_tail;
+    if (m_sq_entries - (tail - head) >= n)
+        return true;
+    // 提交队列放不下，先把已有的交给内核，链接的一组总是在同一次提交里
+    enter(m_to_submit, 0, 0, NULL, 0);
+    m_to_submit = 0;
+    head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    return m_sq_entries - (tail - head) >= n;
+}
+
+struct io_uring_sqe *uring::get_sqe()
+{
+    unsigned tail = *m_sq_tail;
+    unsigned idx = tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = m_sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++m_to_submit;
+    return sqe;
+}
+
+uint64_t uring::tag(int op, int fd) const
+{
+    uint32_t gen = fd < m_max_fd ? m_gen[fd].load(std::memory_order_relaxed) : 0;
+    return ((uint64_t)gen << 32) | ((uint64_t)fd << 8) | op;
+}
+
+bool uring::stale(uint64_t data) const
+{
+    int fd = fd_of(data);
+    return fd < m_max_fd && (uint32_t)(data >> 32) != m_gen[fd].load(std::memory_order_relaxed);
+}
+
+void uring::arm(int fd, int ev)
+{
+    uring_arm a = {fd, ev};
+    m_arm_lock.lock();
+    bool first = m_arms.empty();
+    m_arms.push_back(a);
+    m_arm_lock.unlock();
+    // 主线程每轮等待前都会取走arm请求，只有工作线程放入第一个请求时需要唤醒
+    if (first && !pthread_equal(pthread_self(), m_owner))
+    {
+        uint64_t one = 1;
+        ::write(m_wake_fd, &one, sizeof(one));
+    }
+}
+
+void uring::take_arms(std::vector<uring_arm> &out)
+{
+    out.clear();
+    m_arm_lock.lock();
+    m_arms.swap(out);
+    m_arm_lock.unlock();
+}
+
+void uring::close_fd(int fd)
+{
+    if (fd < m_max_fd)
+        m_gen[fd].fetch_add(1, std::memory_order_relaxed);
+    // 挂起的recv持有socket的引用，只close不会结束它；shutdown让它立即完成
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+bool uring::prep_accept(int listenfd)
+{
+    if (!reserve(1))
+        return false;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    // 多发accept，一次提交持续产生新连接，直到出错才需要重新提交
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = tag(URING_ACCEPT, listenfd);
+    return true;
+}
+
+bool uring::prep_recv(int fd, char *buf, int len)
+{
+    if (!reserve(1))
+        return false;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = tag(URING_RECV, fd);
+    return true;
+}
+
+bool uring::prep_send(int fd, const struct iovec *iov, int count)
+{
+    // 整条链一次占好位置，中途提交会让已经入队的一段带着IOSQE_IO_LINK结束，链被截断。
+    // 比提交队列还长的只发前面一部分，剩下的由调用者在这条链发完后再提交
+    if ((unsigned)count > m_sq_entries)
+        count = m_sq_entries;
+    if (!reserve(count))
+        return false;
+    for (int i = 0; i < count; ++i)
+    {
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)iov[i].iov_base;
+        sqe->len = iov[i].iov_len;
+        // 流式socket上WAITALL让内核自己重试短写，发完整段才完成
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (i + 1 < count)
+        {
+            // 响应头带MSG_MORE，和响应体合并成一个报文，否则Nagle会等对方的延迟确认
+            sqe->msg_flags |= MSG_MORE;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = tag(URING_SEND, fd);
+        }
+        else
+            sqe->user_data = tag(URING_SEND_LAST, fd);
+    }
+    return true;
+}
+
+bool uring::prep_poll(int fd, int op)
+{
+    if (!reserve(1))
+        return false;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = tag(op, fd);
+    return true;
+}
+
+bool uring::prep_wake()
+{
+    if (!reserve(1))
+        return false;
+    struct io_uring_sqe *sqe = get_sqe();
+    // 直接读eventfd，完成时计数已经清零，不需要再调用一次read
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_wake_buf;
+    sqe->len = sizeof(m_wake_buf);
+    sqe->user_data = tag(URING_WAKE, m_wake_fd);
+    return true;
+}
+
+int uring::submit_and_wait(int timeout_ms)
+{
+    // 已经有完成事件时只提交不等待
+    unsigned wait = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) == *m_cq_head ? 1 : 0;
+    if (!wait && 0 == m_to_submit)
+        return 0;
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int ret = enter(m_to_submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret >= 0)
+        m_to_submit = 0;
+    else if (errno == ETIME || errno == EINTR)
+    {
+        // 超时或被信号打断时提交也已经完成
+        m_to_submit = 0;
+        ret = 0;
+    }
+    return ret;
+}
+
+struct io_uring_cqe *uring::peek()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return m_cqes + (head & *m_cq_mask);
+}
+
+void uring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
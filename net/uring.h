@@ -0,0 +1,130 @@
+/*************************************************************
+*io_uring事件后端
+*不依赖liburing，直接用io_uring_setup/io_uring_enter系统调用
+*主线程独占提交队列：多发accept、接收直接读进http_conn的读缓冲区、
+*响应头和响应体用两个链接的send发出
+*工作线程通过arm请求主线程提交接收或发送，代替epoll下的modfd
+**************************************************************/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <vector>
+#include <linux/io_uring.h>
+#include "../lock/locker.h"
+
+// 完成事件的类型，存在user_data的低8位
+enum URING_OP
+{
+    URING_ACCEPT = 0, // 多发accept
+    URING_RECV,       // 接收请求
+    URING_SEND,       // 发送响应的中间一段
+    URING_SEND_LAST,  // 发送响应的最后一段
+    URING_SIGNAL,     // 信号管道可读，多发poll
+    URING_WAKE,       // 工作线程唤醒主线程的eventfd
+    URING_CORO,       // 协程调度器的eventfd可读，多发poll
+};
+
+// 工作线程请求主线程为fd提交的操作
+struct uring_arm
+{
+    int fd;
+    int ev; // EPOLLIN或EPOLLOUT，沿用modfd的参数
+};
+
+class uring
+{
+public:
+    static uring *get_instance()
+    {
+        static uring instance;
+        return &instance;
+    }
+
+    // entries是提交队列长度，max_fd是连接fd的上限；内核不支持时返回false
+    bool init(unsigned entries, int max_fd);
+    bool enabled() const { return m_ring_fd >= 0; }
+
+    // 任意线程调用，代替modfd；由主线程在下一轮提交
+    void arm(int fd, int ev);
+    // 主线程取走所有待提交的arm请求
+    void take_arms(std::vector<uring_arm> &out);
+    // 任意线程调用，关闭连接；之后到达的该连接的完成事件都会被丢弃
+    void close_fd(int fd);
+
+    // 以下只能由主线程调用，提交队列交给内核后仍然放不下时返回false，什么也不做
+    bool prep_accept(int listenfd);
+    bool prep_recv(int fd, char *buf, int len);
+    // 响应分多段时前面的段带IOSQE_IO_LINK，后一段在前一段全部发完后才会执行；整条链放在同一次提交里
+    bool prep_send(int fd, const struct iovec *iov, int count);
+    bool prep_poll(int fd, int op);
+    bool prep_wake();
+    // 提交并等待至少一个完成事件，最多等待timeout_ms毫秒
+    int submit_and_wait(int timeout_ms);
+    // 取一个完成事件，没有时返回NULL；处理完后调用cqe_seen
+    struct io_uring_cqe *peek();
+    void cqe_seen();
+
+    static int op_of(uint64_t data) { return data & 0xff; }
+    static int fd_of(uint64_t data) { return (data >> 8) & 0xffffff; }
+    // 连接关闭后到达的完成事件
+    bool stale(uint64_t data) const;
+
+    // io_uring_enter调用次数，用于对比每个请求的系统调用数
+    uint64_t enter_calls() const { return m_enter_calls; }
+
+private:
+    uring();
+    ~uring();
+
+    // 创建环并映射提交、完成队列
+    bool setup(unsigned entries);
+    // 在本地socket上各提交一次多发accept和多发poll，都带着IORING_CQE_F_MORE完成才算支持
+    bool probe_multishot();
+
+    // 保证提交队列里还有n个空位，不够时先提交已有的条目
+    bool reserve(unsigned n);
+    // 调用前必须reserve
+    struct io_uring_sqe *get_sqe();
+    uint64_t tag(int op, int fd) const;
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz);
+
+private:
+    int m_ring_fd;
+    unsigned m_sq_entries;
+    void *m_sq_ptr;
+    size_t m_sq_len;
+    void *m_cq_ptr;
+    size_t m_cq_len;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_len;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    // 已写入提交队列但还没交给内核的条目数
+    unsigned m_to_submit;
+
+    // 每个fd上连接的代数，关闭时加一；user_data里带着提交时的代数
+    std::atomic<uint32_t> *m_gen;
+    int m_max_fd;
+
+    // 工作线程的arm请求
+    locker m_arm_lock;
+    std::vector<uring_arm> m_arms;
+    pthread_t m_owner;
+    int m_wake_fd;
+    uint64_t m_wake_buf;
+
+    uint64_t m_enter_calls;
+};
+
+#endif
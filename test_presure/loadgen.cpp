@@ -0,0 +1,512 @@
+/*************************************************************
+*基于epoll的HTTP压测客户端
+*每个线程一个epoll，管理一组非阻塞连接，支持三种负载
+*   keepalive 长连接，每次一个请求
+*   pipeline  长连接，每次连续发送depth个请求再等响应
+*   churn     短连接，每个请求重新建立连接(延迟包含三次握手)
+*   burst     短连接，每个线程的所有连接同时发起，全部结束后再发起下一波，测突发建连的延迟
+*延迟用与服务器/metrics相同的HDR直方图统计，结果以一行JSON输出
+*用法: ./loadgen [-H ip] [-p port] [-c 连接数] [-t 线程数] [-d 秒] [-w 负载] [-D depth] [-T 超时ms] [-u 路径]...
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+#include "../metrics/hdr_histogram.h"
+
+enum WORKLOAD
+{
+    WORKLOAD_KEEPALIVE = 0,
+    WORKLOAD_PIPELINE,
+    WORKLOAD_CHURN,
+    WORKLOAD_BURST,
+    WORKLOAD_COUNT
+};
+
+static const char *WORKLOAD_NAME[WORKLOAD_COUNT] = {"keepalive", "pipeline", "churn", "burst"};
+
+struct options
+{
+    const char *host;
+    int port;
+    int connections;
+    int threads;
+    int duration;
+    int workload;
+    int depth;
+    int timeout_ms;
+    const char *encoding;
+    std::vector<std::string> paths;
+};
+
+static options g_opt;
+static volatile bool g_stop = false;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct thread_stat
+{
+    hdr_histogram latency;
+    uint64_t requests;
+    uint64_t non2xx;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t connects;
+    uint64_t bytes;
+
+    thread_stat() : requests(0), non2xx(0), errors(0), timeouts(0), connects(0), bytes(0) {}
+};
+
+// 一个连接上的收发状态
+struct conn
+{
+    int fd;
+    std::string out;      // 待发送的请求
+    size_t out_pos;
+    int64_t sent[64];     // 已发出未响应的请求的发送时刻，按顺序排队
+    int head, inflight;
+    int64_t connect_at;   // churn和burst下延迟从发起连接算起
+    int64_t last_active;
+    char in[16384];
+    int in_len;
+    long body_left;       // 正在跳过的响应体剩余字节，-1表示在读响应头
+    int status;
+    int next_path;
+};
+
+struct worker_ctx
+{
+    int id;
+    int epfd;
+    std::vector<conn> conns;
+    int open;             // burst下本波还没结束的连接数
+    thread_stat *stat;
+};
+
+// 短连接负载，每个请求一个连接
+static bool short_lived()
+{
+    return g_opt.workload == WORKLOAD_CHURN || g_opt.workload == WORKLOAD_BURST;
+}
+
+static std::string build_request(const std::string &path, bool keepalive)
+{
+    std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + g_opt.host + "\r\nConnection: " + (keepalive ? "keep-alive" : "close") + "\r\n";
+    if (g_opt.encoding)
+        req += std::string("Accept-Encoding: ") + g_opt.encoding + "\r\n";
+    return req + "\r\n";
+}
+
+static void close_conn(worker_ctx *ctx, conn &c)
+{
+    if (c.fd >= 0)
+    {
+        epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+    }
+    c.fd = -1;
+}
+
+// 填充一批请求：pipeline一次depth个，其余一次一个
+static void queue_requests(conn &c)
+{
+    int n = g_opt.workload == WORKLOAD_PIPELINE ? g_opt.depth : 1;
+    bool keepalive = !short_lived();
+    c.out.clear();
+    c.out_pos = 0;
+    int64_t now = now_ns();
+    for (int i = 0; i < n; ++i)
+    {
+        c.out += build_request(g_opt.paths[c.next_path], keepalive);
+        c.next_path = (c.next_path + 1) % g_opt.paths.size();
+        c.sent[(c.head + c.inflight) % 64] = short_lived() ? c.connect_at : now;
+        c.inflight++;
+    }
+}
+
+static bool open_conn(worker_ctx *ctx, conn &c)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_opt.port);
+    inet_pton(AF_INET, g_opt.host, &addr.sin_addr);
+
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c.connect_at = now_ns();
+    c.last_active = c.connect_at;
+    if (connect(c.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.head = c.inflight = 0;
+    c.in_len = 0;
+    c.body_left = -1;
+    ctx->stat->connects++;
+    queue_requests(c);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = &c;
+    epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+// burst下一波连接同时发起
+static void open_wave(worker_ctx *ctx)
+{
+    ctx->open = 0;
+    for (size_t i = 0; i < ctx->conns.size(); ++i)
+    {
+        if (open_conn(ctx, ctx->conns[i]))
+            ctx->open++;
+        else
+            ctx->stat->errors++;
+    }
+}
+
+static void reopen(worker_ctx *ctx, conn &c)
+{
+    close_conn(ctx, c);
+    if (g_stop)
+        return;
+    // burst等这一波的连接全部结束后再一起重连
+    if (g_opt.workload == WORKLOAD_BURST)
+    {
+        if (--ctx->open == 0)
+            open_wave(ctx);
+        return;
+    }
+    if (!open_conn(ctx, c))
+        ctx->stat->errors++;
+}
+
+static void set_events(worker_ctx *ctx, conn &c, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = &c;
+    epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// 一个响应收完
+static void complete(worker_ctx *ctx, conn &c)
+{
+    int64_t now = now_ns();
+    thread_stat *st = ctx->stat;
+    st->latency.record(now - c.sent[c.head]);
+    st->requests++;
+    if (c.status < 200 || c.status >= 300)
+        st->non2xx++;
+    c.head = (c.head + 1) % 64;
+    c.inflight--;
+    c.last_active = now;
+}
+
+// 解析缓冲区中的响应，返回false表示连接出错
+static bool parse_responses(worker_ctx *ctx, conn &c)
+{
+    int pos = 0;
+    while (pos < c.in_len)
+    {
+        if (c.body_left < 0)
+        {
+            c.in[c.in_len] = '\0';
+            char *end = strstr(c.in + pos, "\r\n\r\n");
+            if (!end)
+                break;
+            if (c.in_len - pos < 12 || strncmp(c.in + pos, "HTTP/1.", 7) != 0)
+                return false;
+            c.status = atoi(c.in + pos + 9);
+            long length = 0;
+            for (char *line = c.in + pos; line < end; line = strstr(line, "\r\n") + 2)
+            {
+                if (strncasecmp(line, "Content-Length:", 15) == 0)
+                    length = atol(line + 15);
+            }
+            pos = end + 4 - c.in;
+            c.body_left = length;
+        }
+        long take = c.in_len - pos < c.body_left ? c.in_len - pos : c.body_left;
+        pos += take;
+        c.body_left -= take;
+        if (c.body_left > 0)
+            break;
+        c.body_left = -1;
+        if (c.inflight <= 0)
+            return false;
+        complete(ctx, c);
+    }
+    memmove(c.in, c.in + pos, c.in_len - pos);
+    c.in_len -= pos;
+    return true;
+}
+
+static void on_readable(worker_ctx *ctx, conn &c)
+{
+    while (true)
+    {
+        int n = recv(c.fd, c.in + c.in_len, sizeof(c.in) - 1 - c.in_len, 0);
+        if (n > 0)
+        {
+            ctx->stat->bytes += n;
+            c.in_len += n;
+            if (!parse_responses(ctx, c))
+            {
+                ctx->stat->errors++;
+                reopen(ctx, c);
+                return;
+            }
+            // 响应头超过缓冲区
+            if (c.in_len >= (int)sizeof(c.in) - 1)
+            {
+                ctx->stat->errors++;
+                reopen(ctx, c);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        // 对端关闭：短连接的正常结束，长连接上有未完成请求则记错误
+        if (c.inflight > 0)
+            ctx->stat->errors++;
+        reopen(ctx, c);
+        return;
+    }
+
+    if (c.inflight == 0)
+    {
+        // 短连接等服务器关闭后再重连，长连接直接发下一批
+        if (short_lived())
+            return;
+        queue_requests(c);
+        set_events(ctx, c, EPOLLIN | EPOLLOUT);
+    }
+}
+
+static void on_writable(worker_ctx *ctx, conn &c)
+{
+    while (c.out_pos < c.out.size())
+    {
+        int n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            ctx->stat->errors++;
+            reopen(ctx, c);
+            return;
+        }
+        c.out_pos += n;
+    }
+    set_events(ctx, c, EPOLLIN);
+}
+
+static void *worker(void *arg)
+{
+    worker_ctx *ctx = (worker_ctx *)arg;
+    ctx->epfd = epoll_create1(0);
+    for (size_t i = 0; i < ctx->conns.size(); ++i)
+    {
+        conn &c = ctx->conns[i];
+        c.fd = -1;
+        c.next_path = (ctx->id + i) % g_opt.paths.size();
+    }
+    if (g_opt.workload == WORKLOAD_BURST)
+        open_wave(ctx);
+    else
+    {
+        for (size_t i = 0; i < ctx->conns.size(); ++i)
+        {
+            if (!open_conn(ctx, ctx->conns[i]))
+                ctx->stat->errors++;
+        }
+    }
+
+    struct epoll_event events[256];
+    int64_t last_check = now_ns();
+    while (!g_stop)
+    {
+        int n = epoll_wait(ctx->epfd, events, 256, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            conn &c = *(conn *)events[i].data.ptr;
+            if (c.fd < 0)
+                continue;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN))
+            {
+                ctx->stat->errors++;
+                reopen(ctx, c);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+                on_writable(ctx, c);
+            if (c.fd >= 0 && (events[i].events & EPOLLIN))
+                on_readable(ctx, c);
+        }
+
+        // 超时的连接记一次超时后重连
+        int64_t now = now_ns();
+        if (now - last_check > 100000000LL)
+        {
+            last_check = now;
+            for (size_t i = 0; i < ctx->conns.size(); ++i)
+            {
+                conn &c = ctx->conns[i];
+                if (c.fd >= 0 && c.inflight > 0 && now - c.last_active > g_opt.timeout_ms * 1000000LL)
+                {
+                    ctx->stat->timeouts++;
+                    reopen(ctx, c);
+                }
+                else if (c.fd < 0 && g_opt.workload != WORKLOAD_BURST)
+                    reopen(ctx, c);
+            }
+            if (g_opt.workload == WORKLOAD_BURST && ctx->open <= 0)
+                open_wave(ctx);
+        }
+    }
+    for (size_t i = 0; i < ctx->conns.size(); ++i)
+        close_conn(ctx, ctx->conns[i]);
+    close(ctx->epfd);
+    return NULL;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: loadgen [-H ip] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+                    "               [-w keepalive|pipeline|churn|burst] [-D depth] [-T timeout_ms] [-e encoding] [-u path]...\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    g_opt.host = "127.0.0.1";
+    g_opt.port = 9006;
+    g_opt.connections = 64;
+    g_opt.threads = 1;
+    g_opt.duration = 10;
+    g_opt.workload = WORKLOAD_KEEPALIVE;
+    g_opt.depth = 8;
+    g_opt.timeout_ms = 2000;
+    g_opt.encoding = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:t:d:w:D:T:e:u:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            g_opt.host = optarg;
+            break;
+        case 'p':
+            g_opt.port = atoi(optarg);
+            break;
+        case 'c':
+            g_opt.connections = atoi(optarg);
+            break;
+        case 't':
+            g_opt.threads = atoi(optarg);
+            break;
+        case 'd':
+            g_opt.duration = atoi(optarg);
+            break;
+        case 'w':
+            g_opt.workload = -1;
+            for (int i = 0; i < WORKLOAD_COUNT; ++i)
+                if (strcmp(optarg, WORKLOAD_NAME[i]) == 0)
+                    g_opt.workload = i;
+            if (g_opt.workload < 0)
+                usage();
+            break;
+        case 'D':
+            g_opt.depth = atoi(optarg);
+            break;
+        case 'T':
+            g_opt.timeout_ms = atoi(optarg);
+            break;
+        case 'e':
+            g_opt.encoding = optarg;
+            break;
+        case 'u':
+            g_opt.paths.push_back(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (g_opt.paths.empty())
+        g_opt.paths.push_back("/index.html");
+    if (g_opt.depth < 1 || g_opt.depth > 64 || g_opt.threads < 1 || g_opt.connections < g_opt.threads)
+        usage();
+
+    std::vector<worker_ctx> ctxs(g_opt.threads);
+    std::vector<thread_stat *> stats;
+    std::vector<pthread_t> tids(g_opt.threads);
+    int64_t start = now_ns();
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        ctxs[i].id = i;
+        ctxs[i].conns.resize(g_opt.connections / g_opt.threads + (i < g_opt.connections % g_opt.threads ? 1 : 0));
+        ctxs[i].stat = new thread_stat();
+        pthread_create(&tids[i], NULL, worker, &ctxs[i]);
+    }
+    sleep(g_opt.duration);
+    g_stop = true;
+    for (int i = 0; i < g_opt.threads; ++i)
+        pthread_join(tids[i], NULL);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // 合并各线程的结果
+    static uint64_t buckets[hdr_histogram::BUCKETS];
+    uint64_t sum = 0, requests = 0, non2xx = 0, errors = 0, timeouts = 0, connects = 0, bytes = 0;
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        thread_stat *st = ctxs[i].stat;
+        st->latency.merge_into(buckets, sum);
+        requests += st->requests;
+        non2xx += st->non2xx;
+        errors += st->errors;
+        timeouts += st->timeouts;
+        connects += st->connects;
+        bytes += st->bytes;
+        delete st;
+    }
+
+    printf("{\"workload\":\"%s\",\"connections\":%d,\"threads\":%d,\"depth\":%d,\"duration_s\":%.3f,"
+           "\"requests\":%llu,\"rps\":%.1f,\"mbps\":%.2f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,"
+           "\"mean_us\":%.1f,\"non2xx\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"connects\":%llu}\n",
+           WORKLOAD_NAME[g_opt.workload], g_opt.connections, g_opt.threads,
+           g_opt.workload == WORKLOAD_PIPELINE ? g_opt.depth : 1, elapsed,
+           (unsigned long long)requests, requests / elapsed, bytes * 8 / elapsed / 1e6,
+           hdr_histogram::quantile(buckets, requests, 0.5) / 1000.0, hdr_histogram::quantile(buckets, requests, 0.99) / 1000.0,
+           hdr_histogram::quantile(buckets, requests, 0.999) / 1000.0, hdr_histogram::quantile(buckets, requests, 1.0) / 1000.0,
+           requests ? sum / 1000.0 / requests : 0.0, (unsigned long long)non2xx, (unsigned long long)errors,
+           (unsigned long long)timeouts, (unsigned long long)connects);
+    return 0;
+}
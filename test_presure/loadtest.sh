@@ -0,0 +1,112 @@
+#!/bin/bash
+# 可复现的压测：生成固定的root/resources/语料，按触发模式(-m 0..3)和并发模型(-a 0/1)逐一启动服务器，
+# 用loadgen跑keepalive/pipeline/churn三种负载，结果汇总成一个JSON文件便于跨提交对比
+# 每项负载前后各取一次/metrics，算出每个响应平均的epoll_ctl次数
+#
+# 用法: ./test_presure/loadtest.sh [输出文件]
+# 环境变量: DURATION(每项秒数,默认10) CONNS(连接数,默认64) THREADS(loadgen线程数,默认1)
+#           DEPTH(pipeline深度,默认8) PORT(默认9106) MODES(默认"0 1 2 3") ACTORS(默认"0 1")
+#           WORKLOADS(默认"keepalive pipeline churn") SERVER_ARGS(额外的服务器参数)
+
+set -e
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${1:-loadtest.json}
+DURATION=${DURATION:-10}
+CONNS=${CONNS:-64}
+THREADS=${THREADS:-1}
+DEPTH=${DEPTH:-8}
+PORT=${PORT:-9106}
+MODES=${MODES:-"0 1 2 3"}
+ACTORS=${ACTORS:-"0 1"}
+WORKLOADS=${WORKLOADS:-"keepalive pipeline churn"}
+SERVER_ARGS=${SERVER_ARGS:-}
+
+SERVER=$REPO/server
+LOADGEN=$REPO/test_presure/loadgen
+for bin in "$SERVER" "$LOADGEN"; do
+    if [ ! -x "$bin" ]; then
+        echo "missing $bin, run: make server loadgen" >&2
+        exit 1
+    fi
+done
+
+# 固定内容的语料，大小覆盖小页面、中等页面和大文件
+WORK=$(mktemp -d /tmp/tws_loadtest.XXXXXX)
+SERVER_PID=
+cleanup()
+{
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+mkdir -p "$WORK/root/resources"
+gen_file()
+{
+    # 可打印的确定性内容，每次运行完全相同
+    yes "tinywebserver loadtest corpus $1" | head -c "$2" > "$WORK/root/resources/$1"
+}
+gen_file small.html 512
+gen_file medium.html 16384
+gen_file large.html 262144
+PATHS="-u /small.html -u /small.html -u /small.html -u /medium.html -u /large.html"
+
+wait_port()
+{
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# 输出服务器累计的epoll_ctl次数和响应数
+scrape()
+{
+    exec 3<>/dev/tcp/127.0.0.1/$PORT
+    printf 'GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n' >&3
+    awk '/^tinywebserver_epoll_ctl_total /{c=$2} /^tinywebserver_requests_total/{r+=$2} END{print c+0, r+0}' <&3
+    exec 3<&-
+}
+
+COMMIT=$(git -C "$REPO" rev-parse --short HEAD 2>/dev/null || echo unknown)
+{
+    printf '{"commit":"%s","date":"%s","host":"%s","cpus":%s,' "$COMMIT" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)" "$(nproc)"
+    printf '"duration_s":%s,"connections":%s,"loadgen_threads":%s,"results":[' "$DURATION" "$CONNS" "$THREADS"
+} > "$OUT"
+
+FIRST=1
+for m in $MODES; do
+    for a in $ACTORS; do
+        # 关闭日志、不连接数据库，服务器在语料目录下运行，root/resources即生成的语料
+        (cd "$WORK" && exec "$SERVER" -p "$PORT" -m "$m" -a "$a" -c 1 -d 2 $SERVER_ARGS > "$WORK/server.out" 2>&1) &
+        SERVER_PID=$!
+        if ! wait_port; then
+            echo "server failed to start with -m $m -a $a:" >&2
+            cat "$WORK/server.out" >&2
+            exit 1
+        fi
+        for w in $WORKLOADS; do
+            BEFORE=$(scrape)
+            RESULT=$("$LOADGEN" -p "$PORT" -c "$CONNS" -t "$THREADS" -d "$DURATION" -w "$w" -D "$DEPTH" $PATHS)
+            # loadgen退出时关闭所有连接，等服务器处理完关闭再取
+            sleep 0.2
+            CTL=$(echo "$BEFORE $(scrape)" | awk '{r = $4 - $2; printf "%.2f", r > 0 ? ($3 - $1) / r : 0}')
+            echo "m=$m a=$a epoll_ctl/req=$CTL $RESULT" >&2
+            [ $FIRST -eq 1 ] || printf ',' >> "$OUT"
+            FIRST=0
+            printf '{"trig_mode":%s,"actor_model":%s,"epoll_ctl_per_req":%s,%s' "$m" "$a" "$CTL" "${RESULT#\{}" >> "$OUT"
+        done
+        kill "$SERVER_PID"
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    done
+done
+printf ']}\n' >> "$OUT"
+echo "results written to $OUT" >&2
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "admission.h"
+#include "../metrics/metrics.h"
+
+static_assert(SHED_REASON_COUNT == METRIC_SHED_END - METRIC_SHED_BASE, "SHED_REASON out of sync with METRIC_COUNTER");
+
+admission::admission()
+    : m_target_ns(0), m_db_limit(0), m_db_inflight(0), m_interval_end(0), m_min_sojourn(INT64_MAX), m_overloaded(false)
+{
+}
+
+void admission::init(int target_ms, int db_limit)
+{
+    m_target_ns = target_ms > 0 ? target_ms * 1000000LL : 0;
+    m_db_limit = db_limit > 0 ? db_limit : 0;
+}
+
+bool admission::admit(int64_t now_ns, int64_t sojourn_ns)
+{
+    if (0 == m_target_ns)
+        return true;
+    // 区间结束时由一个线程判断整个区间是否过载，没有请求的区间不算
+    int64_t end = m_interval_end.load(std::memory_order_relaxed);
+    if (now_ns >= end && m_interval_end.compare_exchange_strong(end, now_ns + INTERVAL_NS, std::memory_order_relaxed))
+    {
+        int64_t min = m_min_sojourn.exchange(INT64_MAX, std::memory_order_relaxed);
+        m_overloaded.store(min != INT64_MAX && min > m_target_ns, std::memory_order_relaxed);
+    }
+    int64_t min = m_min_sojourn.load(std::memory_order_relaxed);
+    while (sojourn_ns < min && !m_min_sojourn.compare_exchange_weak(min, sojourn_ns, std::memory_order_relaxed))
+        ;
+    int64_t limit = m_target_ns > INTERVAL_NS ? m_target_ns : INTERVAL_NS;
+    if (m_overloaded.load(std::memory_order_relaxed))
+        limit = m_target_ns;
+    return sojourn_ns <= limit;
+}
+
+bool admission::db_enter()
+{
+    if (0 == m_db_limit)
+        return true;
+    if (m_db_inflight.fetch_add(1, std::memory_order_relaxed) < m_db_limit)
+        return true;
+    m_db_inflight.fetch_sub(1, std::memory_order_relaxed);
+    shed(SHED_DB);
+    return false;
+}
+
+void admission::db_exit()
+{
+    if (m_db_limit)
+        m_db_inflight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void admission::shed(int reason)
+{
+    metrics::get_instance()->count(METRIC_SHED_BASE + reason);
+}
+
+const char *admission::busy_form = "The server is too busy, please retry later.\n";
+
+const char *admission::busy_response()
+{
+    // 不带Date等每次都要生成的头，生成一次后主线程直接发出
+    static const std::string response = [] {
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "HTTP/1.1 503 Service Unavailable\r\nContent-Length:%zu\r\nContent-Type:text/plain\r\n"
+                 "Retry-After:%d\r\nConnection:close\r\n\r\n%s",
+                 strlen(busy_form), RETRY_AFTER, busy_form);
+        return std::string(buf);
+    }();
+    return response.c_str();
+}
@@ -0,0 +1,91 @@
+/*************************************************************
+*准入控制
+*过载时尽早用503拒绝请求，而不是让它们在队列里越排越久：
+*  排队时间: 按CoDel的思路，每个100ms的区间里排队时间的最小值都超过目标，
+*            说明队列一直没有排空，是持续过载而不是突发；这时排队超过目标的请求直接拒绝，
+*            未过载时只拒绝排队超过一个区间的请求
+*  数据库:   同时在等待或占用数据库连接的请求超过上限时，新的请求直接拒绝
+*拒绝的响应带Retry-After，不解析请求、不访问文件系统和数据库
+**************************************************************/
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <atomic>
+
+// 拒绝的原因，用于计数
+enum SHED_REASON
+{
+    SHED_QUEUE = 0, // 排队时间超过目标
+    SHED_DB,        // 数据库请求数超过上限
+    SHED_FULL,      // 线程池请求队列满
+    SHED_CONN,      // 连接数达到MAX_FD
+    SHED_REASON_COUNT
+};
+
+class admission
+{
+public:
+    static admission *get_instance()
+    {
+        static admission instance;
+        return &instance;
+    }
+
+    // target_ms是排队时间目标，0表示不按排队时间拒绝；db_limit是同时进行的数据库请求上限，0表示不限
+    void init(int target_ms, int db_limit);
+
+    // 工作线程取出请求时调用，sojourn_ns是请求在队列里等待的时间。
+    // 返回false表示应当拒绝；队列里也有写事件和协程，是否真的拒绝由调用者决定，拒绝时调用shed计数
+    bool admit(int64_t now_ns, int64_t sojourn_ns);
+
+    // 请求要使用数据库前调用，返回false表示应当拒绝，已经计数；返回true的要调用db_exit
+    bool db_enter();
+    void db_exit();
+
+    // 记录一次拒绝
+    void shed(int reason);
+
+    // 来不及生成响应时直接发出的完整503响应，连接随后关闭
+    static const char *busy_response();
+    // 503响应的Retry-After，单位秒，和响应体
+    static const int RETRY_AFTER = 1;
+    static const char *busy_form;
+
+private:
+    admission();
+
+    // CoDel的观察区间
+    static const int64_t INTERVAL_NS = 100 * 1000000LL;
+
+    int64_t m_target_ns;
+    int m_db_limit;
+    std::atomic<int> m_db_inflight;
+    // 当前区间的结束时间和区间内排队时间的最小值
+    std::atomic<int64_t> m_interval_end;
+    std::atomic<int64_t> m_min_sojourn;
+    // 上一个区间的最小排队时间超过目标
+    std::atomic<bool> m_overloaded;
+};
+
+// 在作用域内占用一个数据库请求名额，协程处理函数里可以跨co_await持有
+class db_ticket
+{
+public:
+    db_ticket() : m_held(admission::get_instance()->db_enter()) {}
+    ~db_ticket()
+    {
+        if (m_held)
+            admission::get_instance()->db_exit();
+    }
+    db_ticket(const db_ticket &) = delete;
+    db_ticket &operator=(const db_ticket &) = delete;
+
+    explicit operator bool() const { return m_held; }
+
+private:
+    bool m_held;
+};
+
+#endif
@@ -6,15 +6,17 @@
 #include <exception>
 #include <pthread.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "admission.h"
 
 // 封装线程池
 template <typename T>
 class threadpool
 {
 public:
-    /*actor_model是并发模型，connPool是数据库连接池，thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*actor_model是并发模型，thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000);
     ~threadpool();
     bool append(T *request, int state);
     bool append_p(T *request);
@@ -31,11 +33,10 @@ private:
     std::list<T *> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
 };
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
@@ -75,8 +76,10 @@ bool threadpool<T>::append(T *request, int state)
         return false;
     }
     request->m_state = state;
+    request->m_queued_ns = metrics::now_ns();
     // 向请求队列中添加请求
     m_workqueue.push_back(request);
+    metrics::get_instance()->set_gauge(METRIC_QUEUE_DEPTH, m_workqueue.size());
     m_queuelocker.unlock();
     // 通知信号，有请求可以处理
     m_queuestat.post();
@@ -92,7 +95,9 @@ bool threadpool<T>::append_p(T *request)
         m_queuelocker.unlock();
         return false;
     }
+    request->m_queued_ns = metrics::now_ns();
     m_workqueue.push_back(request);
+    metrics::get_instance()->set_gauge(METRIC_QUEUE_DEPTH, m_workqueue.size());
     m_queuelocker.unlock();
     m_queuestat.post();
     return true;
@@ -122,41 +127,56 @@ void threadpool<T>::run()
         // 从请求队列中取出任务
         T *request = m_workqueue.front();
         m_workqueue.pop_front();
+        metrics::get_instance()->set_gauge(METRIC_QUEUE_DEPTH, m_workqueue.size());
         m_queuelocker.unlock();
         if (!request)
             continue;
+        request->m_trace.begin(TRACE_DEQUEUE);
+        // 排队时间交给准入控制，过载时新请求不解析，直接回503
+        int64_t now = metrics::now_ns();
+        metrics::get_instance()->observe(METRIC_QUEUE, now - request->m_queued_ns);
+        request->m_shed = !admission::get_instance()->admit(now, now - request->m_queued_ns);
         if (1 == m_actor_model)
         {
             if (0 == request->m_state)
             {
+                request->m_trace.begin(TRACE_READ_START);
                 if (request->read_once())
                 {
+                    request->m_trace.end(TRACE_READ_END);
                     request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
                 else
                 {
-                    request->improv = 1;
                     request->timer_flag = 1;
+                    request->improv = 1;
                 }
             }
+            // 协程等的事件到了，主线程不等这个请求的完成标记
+            else if (2 == request->m_state)
+            {
+                request->process();
+            }
             else
             {
                 if (request->write())
                 {
                     request->improv = 1;
+                    // 管线化的后续请求已经在读缓冲区里，不会再有读事件
+                    if (request->pipelined())
+                        request->process();
                 }
                 else
                 {
-                    request->improv = 1;
                     request->timer_flag = 1;
+                    request->improv = 1;
                 }
             }
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            // 数据库连接只在注册时由凭据存储自己获取
             request->process();
         }
     }
@@ -241,7 +241,8 @@ void Utils::timer_handler()
 
 void Utils::show_error(int connfd, const char *info)
 {
-    send(connfd, info, strlen(info), 0);
+    // 不等发送缓冲区，发不出去就算了
+    send(connfd, info, strlen(info), MSG_DONTWAIT | MSG_NOSIGNAL);
     close(connfd);
 }
 
@@ -253,8 +254,7 @@ class Utils;
 // 定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之。
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    close(user_data->sockfd);
+    removefd(Utils::u_epollfd, user_data->sockfd);
     http_conn::m_user_count--;
 }
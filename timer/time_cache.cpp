@@ -0,0 +1,115 @@
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include "time_cache.h"
+
+time_cache::time_cache()
+{
+    m_seq.store(0);
+    m_sec = -1;
+    m_mday = 0;
+    memset(m_local, 0, sizeof(m_local));
+    memset(m_gmt, 0, sizeof(m_gmt));
+    refresh(time(NULL));
+}
+
+void time_cache::refresh(time_t now)
+{
+    if (now == m_sec)
+        return;
+
+    // 时区换算只在这里做，每秒最多一次
+    struct tm local_tm, gmt_tm;
+    localtime_r(&now, &local_tm);
+    gmtime_r(&now, &gmt_tm);
+    char local[20], gmt[32];
+    strftime(local, sizeof(local), "%Y-%m-%d %H:%M:%S", &local_tm);
+    strftime(gmt, sizeof(gmt), "%a, %d %b %Y %H:%M:%S GMT", &gmt_tm);
+
+    // 抢写权，另一个线程正在刷新时直接返回
+    unsigned seq = m_seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || !m_seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+    // 多个线程同时发现过期时，只接受更新的时间
+    if (now > m_sec)
+    {
+        m_sec = now;
+        m_mday = local_tm.tm_mday;
+        memcpy(m_local, local, sizeof(m_local));
+        memcpy(m_gmt, gmt, sizeof(m_gmt));
+    }
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+void time_cache::snapshot(time_t &sec, char *local, char *gmt, int &mday)
+{
+    while (true)
+    {
+        unsigned seq = m_seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        sec = m_sec;
+        mday = m_mday;
+        if (local)
+            memcpy(local, m_local, sizeof(m_local));
+        if (gmt)
+            memcpy(gmt, m_gmt, sizeof(m_gmt));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq.load(std::memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+int time_cache::log_time(const struct timeval &tv, char *out, int *mday)
+{
+    // 每个线程缓存上一次用到的秒
+    static thread_local time_t t_sec = -1;
+    static thread_local int t_mday = 0;
+    static thread_local char t_local[20];
+
+    if (tv.tv_sec != t_sec)
+    {
+        time_t sec;
+        snapshot(sec, t_local, 0, t_mday);
+        if (sec != tv.tv_sec)
+        {
+            refresh(tv.tv_sec);
+            snapshot(sec, t_local, 0, t_mday);
+        }
+        // 刷新被别的线程抢先且对方时间更旧时，本次自己格式化
+        if (sec != tv.tv_sec)
+        {
+            struct tm my_tm;
+            localtime_r(&tv.tv_sec, &my_tm);
+            strftime(t_local, sizeof(t_local), "%Y-%m-%d %H:%M:%S", &my_tm);
+            t_mday = my_tm.tm_mday;
+        }
+        t_sec = tv.tv_sec;
+    }
+
+    memcpy(out, t_local, 19);
+    // 微秒部分每次都变，手工转成6位数字
+    out[19] = '.';
+    long usec = tv.tv_usec;
+    for (int i = 25; i >= 20; --i)
+    {
+        out[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    out[26] = ' ';
+    if (mday)
+        *mday = t_mday;
+    return LOG_TIME_LEN;
+}
+
+int time_cache::http_date(char *out)
+{
+    time_t sec;
+    int mday;
+    snapshot(sec, 0, out, mday);
+    return HTTP_DATE_LEN;
+}
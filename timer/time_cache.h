@@ -0,0 +1,53 @@
+/*************************************************************
+*按秒缓存格式化好的时间字符串
+*日志时间前缀和HTTP Date头共用，同一秒内不再调用localtime/gmtime
+*共享部分用顺序锁保护，读者不加锁；每个线程再缓存一份，秒数不变时不碰共享数据
+**************************************************************/
+
+#ifndef TIME_CACHE_H
+#define TIME_CACHE_H
+
+#include <time.h>
+#include <sys/time.h>
+#include <atomic>
+
+class time_cache
+{
+public:
+    static time_cache *get_instance()
+    {
+        static time_cache instance;
+        return &instance;
+    }
+
+    // 秒数变化时重新格式化，事件循环每秒调用一次，缓存过期时读者也会调用
+    void refresh(time_t now);
+
+    // 写入日志时间前缀 "YYYY-mm-dd HH:MM:SS.uuuuuu "，返回长度
+    // mday不为空时返回当天是几号，用于按天切分日志
+    int log_time(const struct timeval &tv, char *out, int *mday = 0);
+
+    // 拷贝HTTP Date头的值 "Sun, 06 Nov 1994 08:49:37 GMT"，out至少30字节，返回长度
+    int http_date(char *out);
+
+    static const int LOG_TIME_LEN = 27;
+    static const int HTTP_DATE_LEN = 29;
+
+private:
+    time_cache();
+    ~time_cache() {}
+    time_cache(const time_cache &) = delete;
+    time_cache &operator=(const time_cache &) = delete;
+
+    // 读取一份一致的快照
+    void snapshot(time_t &sec, char *local, char *gmt, int &mday);
+
+private:
+    std::atomic<unsigned> m_seq; // 奇数表示正在写
+    time_t m_sec;
+    int m_mday;
+    char m_local[20]; // YYYY-mm-dd HH:MM:SS
+    char m_gmt[32];   // Sun, 06 Nov 1994 08:49:37 GMT
+};
+
+#endif
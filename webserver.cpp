@@ -1,4 +1,8 @@
 #include "webserver.h"
+#include "./auth/file_store.h"
+#ifdef WITH_MYSQL
+#include "./auth/mysql_store.h"
+#endif
 
 WebServer::WebServer()
 {
@@ -16,6 +20,9 @@ WebServer::WebServer()
 
     //定时器
     users_timer = new client_data[MAX_FD];
+
+    m_credentials = NULL;
+    m_connPool = NULL;
 }
 
 WebServer::~WebServer()
@@ -27,10 +34,15 @@ WebServer::~WebServer()
     delete[] users;
     delete[] users_timer;
     delete m_pool;
+    delete m_credentials;
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     int log_level, int log_flush, int queue_wait,
+                     int access_log, int trace_threshold, int credential,
+                     int accept_budget, int backlog, int tcp_profile, int compress_mb, int autoindex,
+                     int large_file_kb, int queue_target_ms, int db_limit, string rate_limit)
 {
     m_port = port;
     m_user = user;
@@ -43,6 +55,35 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    // io_uring后端由内核完成读写，主线程只处理完成事件，固定使用proactor
+    if (4 == m_TRIGMode)
+        m_actormodel = 0;
+    m_log_level = log_level;
+    m_log_flush = log_flush;
+    m_queue_wait = queue_wait;
+    m_access_log = access_log;
+    m_trace_threshold = trace_threshold;
+    m_credential = credential;
+    m_accept_budget = accept_budget > 0 ? accept_budget : 1;
+    m_backlog = backlog > 0 ? backlog : 5;
+    m_accept_pending = false;
+    m_tcp_profile = tcp_profile;
+    m_compress_cache = compress_mb > 0 ? compress_mb : 0;
+    compress_cache::get_instance()->init((size_t)m_compress_cache << 20);
+    m_autoindex = autoindex;
+    http_conn::m_autoindex = 1 == m_autoindex;
+    m_large_file = large_file_kb > 0 ? large_file_kb : 0;
+    http_conn::m_large_file = (off_t)m_large_file << 10;
+    m_queue_target = queue_target_ms > 0 ? queue_target_ms : 0;
+    m_db_limit = db_limit > 0 ? db_limit : 0;
+    admission::get_instance()->init(m_queue_target, m_db_limit);
+    m_rate_limit = rate_limit;
+    // 日志还没有初始化，规则写错时直接退出
+    if (!rate_limiter::get_instance()->parse(m_rate_limit.c_str()))
+    {
+        fprintf(stderr, "invalid rate limit: %s\n", m_rate_limit.c_str());
+        exit(1);
+    }
 }
 
 void WebServer::trig_mode()
@@ -72,6 +113,12 @@ void WebServer::trig_mode()
         m_LISTENTrigmode = 1;
         m_CONNTrigmode = 1;
     }
+    //io_uring，不使用epoll，触发模式只在初始化失败退回epoll时有意义
+    else if (4 == m_TRIGMode)
+    {
+        m_LISTENTrigmode = 1;
+        m_CONNTrigmode = 1;
+    }
 }
 
 void WebServer::log_write()
@@ -80,33 +127,78 @@ void WebServer::log_write()
     {
         //初始化日志
         if (1 == m_log_write)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800, 0, false, m_queue_wait);
+        //每线程环形缓冲区 + 后台批量刷盘
+        else if (2 == m_log_write)
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, 1 << 20);
+        //在环形缓冲区的基础上延迟格式化
+        else if (3 == m_log_write)
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, 1 << 20, true);
         else
             Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+        Log::get_instance()->set_level(m_log_level);
+        Log::get_instance()->set_flush_policy(m_log_flush);
     }
+    //二进制访问日志与文本日志相互独立
+    if (1 == m_access_log)
+        access_log::get_instance()->init("./AccessLog");
+    //慢请求追踪，超过阈值的请求可以从/traces导出
+    if (m_trace_threshold > 0)
+        tracer::get_instance()->init(m_trace_threshold);
 }
 
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
-    m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    //按配置选择凭据存储，只有mysql后端需要数据库连接池
+    if (CREDENTIAL_MYSQL == m_credential)
+    {
+#ifdef WITH_MYSQL
+        //初始化数据库连接池
+        m_connPool = connection_pool::GetInstance();
+        m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+
+        //初始化数据库读取表，将mysql user表读取到内存中
+        mysql_store *store = new mysql_store(m_connPool, m_close_log);
+        store->load();
+        m_credentials = store;
+#else
+        printf("built with MYSQL=0, use -d 1 or -d 2\n");
+        exit(1);
+#endif
+    }
+    //本地mmap哈希文件，不存在时自动创建
+    else if (CREDENTIAL_FILE == m_credential)
+    {
+        file_store *store = new file_store(m_close_log);
+        if (!store->open("./UserStore"))
+        {
+            LOG_ERROR("open ./UserStore failed");
+            printf("open ./UserStore failed\n");
+            exit(1);
+        }
+        m_credentials = store;
+    }
+    //不提供登录注册，保持http_conn默认的空实现
 
-    //初始化数据库读取表，将mysql user表读取到一个map中
-    users->initmysql_result(m_connPool);
+    if (m_credentials)
+        http_conn::m_credentials = m_credentials;
 }
 
 void WebServer::thread_pool()
 {
     // new了一个线程池，存放的是http_conn，并发模型默认proactor
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num);
 }
 
 void WebServer::eventListen()
 {
+    // 动态接口和限速规则都已注册，路由表和限速表在第一个请求到来之前建好
+    http_conn::routes();
+    rate_limiter::get_instance()->build();
+
     // 网络编程基础步骤
     // 创建监听的套接字
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     assert(m_listenfd >= 0);
 
     //优雅关闭连接
@@ -133,11 +225,15 @@ void WebServer::eventListen()
     // 设置address可复用（端口复用）
     int flag = 1;
     setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    // TCP调优选项，缓冲区大小要在listen之前设置
+    m_tcp.init(m_tcp_profile, m_close_log);
+    m_tcp.apply_listen(m_listenfd);
+    LOG_INFO("tcp profile %s", tcp_tuning::name(m_tcp.profile));
     // 绑定当前地址和端口到socket fd
     ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
     // 监听
-    ret = listen(m_listenfd, 5);
+    ret = listen(m_listenfd, m_backlog);
     assert(ret >= 0);
     // 设置超时
     utils.init(TIMESLOT);
@@ -147,6 +243,12 @@ void WebServer::eventListen()
     epoll_event events[MAX_EVENT_NUMBER];
     m_epollfd = epoll_create(5);
     assert(m_epollfd != -1);
+    // io_uring后端，内核不支持时退回ET + ET
+    if (4 == m_TRIGMode && !uring::get_instance()->init(4096, MAX_FD))
+    {
+        LOG_ERROR("%s", "io_uring unavailable, fall back to epoll ET");
+        m_TRIGMode = 3;
+    }
     // 将监听fd添加到epoll，将内核事件表注册读事件
     utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
     // 记录epoll fd
@@ -157,6 +259,13 @@ void WebServer::eventListen()
     utils.setnonblocking(m_pipefd[1]);
     // 这里将进程通信也加入到epoll中了
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+    // 协程处理函数的定时器由事件循环计时，阻塞任务的线程数与数据库连接数相同
+    if (!coro_scheduler::get_instance()->init(m_sql_num, MAX_FD))
+    {
+        LOG_ERROR("%s", "coroutine scheduler init failed");
+        exit(1);
+    }
+    utils.addfd(m_epollfd, coro_scheduler::get_instance()->wake_fd(), false, 0);
 
     // 注册信号捕捉
     // 对SIGPIPE信号进行处理
@@ -212,51 +321,55 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
+void WebServer::shed_conn(util_timer *timer, int sockfd)
+{
+    // 不阻塞主线程，发不出去就直接关闭
+    const char *busy = admission::busy_response();
+    send(sockfd, busy, strlen(busy), MSG_DONTWAIT | MSG_NOSIGNAL);
+    admission::get_instance()->shed(SHED_FULL);
+    LOG_WARN("%s", "request queue full, shed connection");
+    deal_timer(timer, sockfd);
+}
+
 bool WebServer::dealclinetdata()
 {
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    // LT
-    if (0 == m_LISTENTrigmode)
+    socklen_t client_addrlength;
+    // 监听fd是非阻塞的，LT和ET都循环accept直到EAGAIN或用完预算
+    // LT下没accept完的连接下次epoll_wait还会通知；ET下不会，留给eventLoop在本轮事件处理完后继续
+    m_accept_pending = false;
+    for (int i = 0; i < m_accept_budget; ++i)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        // 直接创建非阻塞、exec时关闭的连接，省去setnonblocking的两次fcntl
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD)
-        {
-            // 目前连接数满了
-            // 给客户端写一个信息：服务器内部正忙。
-            utils.show_error(connfd, "Internal server busy");
-            LOG_ERROR("%s", "Internal server busy");
+        if (!addclient(connfd, client_address))
             return false;
-        }
-        // 将新的客户的数据初始化，放到数组中
-        timer(connfd, client_address);
     }
-    // ET
-    else
+    m_accept_pending = 1 == m_LISTENTrigmode;
+    return true;
+}
+
+bool WebServer::addclient(int connfd, struct sockaddr_in client_address)
+{
+    metrics::get_instance()->count(METRIC_ACCEPTS);
+    m_tcp.apply_conn(connfd);
+    if (http_conn::m_user_count >= MAX_FD)
     {
-        while (1)
-        {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
+        // 目前连接数满了，回503后关闭
+        utils.show_error(connfd, admission::busy_response());
+        admission::get_instance()->shed(SHED_CONN);
+        LOG_ERROR("%s", "Internal server busy");
         return false;
     }
+    // 将新的客户的数据初始化，放到数组中
+    timer(connfd, client_address);
     return true;
 }
 
@@ -299,6 +412,8 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
 void WebServer::dealwithread(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    users[sockfd].fired();
+    users[sockfd].m_trace.begin(TRACE_EPOLL);
 
     //reactor
     if (1 == m_actormodel)
@@ -309,7 +424,12 @@ void WebServer::dealwithread(int sockfd)
         }
 
         // 若监测到读事件，将该事件放入请求队列，0表示读事件，一次性把所有数据读完
-        m_pool->append(users + sockfd, 0);
+        users[sockfd].m_trace.begin(TRACE_ENQUEUE);
+        if (!m_pool->append(users + sockfd, 0))
+        {
+            shed_conn(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
@@ -328,12 +448,19 @@ void WebServer::dealwithread(int sockfd)
     else
     {
         //proactor
+        users[sockfd].m_trace.begin(TRACE_READ_START);
         if (users[sockfd].read_once())
         {
+            users[sockfd].m_trace.end(TRACE_READ_END);
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
             //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            users[sockfd].m_trace.begin(TRACE_ENQUEUE);
+            if (!m_pool->append_p(users + sockfd))
+            {
+                shed_conn(timer, sockfd);
+                return;
+            }
 
             if (timer)
             {
@@ -350,6 +477,7 @@ void WebServer::dealwithread(int sockfd)
 void WebServer::dealwithwrite(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    users[sockfd].fired();
     //reactor
     if (1 == m_actormodel)
     {
@@ -358,7 +486,13 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
+        // 响应发到一半，只能关闭连接
+        if (!m_pool->append(users + sockfd, 1))
+        {
+            admission::get_instance()->shed(SHED_FULL);
+            deal_timer(timer, sockfd);
+            return;
+        }
 
         while (true)
         {
@@ -380,6 +514,12 @@ void WebServer::dealwithwrite(int sockfd)
         if (users[sockfd].write())
         {
             LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            //管线化的后续请求已经读到，直接交给线程池
+            if (users[sockfd].pipelined() && !m_pool->append_p(users + sockfd))
+            {
+                shed_conn(timer, sockfd);
+                return;
+            }
 
             if (timer)
             {
@@ -393,20 +533,51 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
+void WebServer::dealwithcoro()
+{
+    m_coro_ready.clear();
+    coro_scheduler::get_instance()->poll(m_coro_ready);
+    for (size_t i = 0; i < m_coro_ready.size(); ++i)
+    {
+        http_conn *conn = m_coro_ready[i];
+        util_timer *timer = users_timer[conn - users].timer;
+        if (timer)
+        {
+            adjust_timer(timer);
+        }
+        // reactor下主线程不等协程执行完
+        bool queued = 1 == m_actormodel ? m_pool->append(conn, 2) : m_pool->append_p(conn);
+        // 请求队列满了，下一轮再交
+        if (!queued)
+            coro_scheduler::get_instance()->ready(conn);
+    }
+}
+
 void WebServer::eventLoop()
 {
+    if (uring::get_instance()->enabled())
+    {
+        eventLoopUring();
+        return;
+    }
     bool timeout = false;
     bool stop_server = false;
     // 这里轮询了
     while (!stop_server)
     {
         // 事件触发数
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        // 最多等待1秒，保证缓存的时间字符串每秒刷新一次
+        // 还有没accept完的连接时不等待，处理完已就绪的事件后继续accept
+        // 协程的定时器快到期时等得更短
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER,
+                                m_accept_pending ? 0 : coro_scheduler::get_instance()->timeout(1000));
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
             break;
         }
+        time_cache::get_instance()->refresh(time(NULL));
+        bool listen_ready = false;
         // 循环遍历事件数组
         for (int i = 0; i < number; i++)
         {
@@ -417,6 +588,7 @@ void WebServer::eventLoop()
             if (sockfd == m_listenfd)
             {
                 // 有客户端连接进来，处理新到的客户连接
+                listen_ready = true;
                 bool flag = dealclinetdata();
                 if (false == flag)
                     continue;
@@ -435,6 +607,11 @@ void WebServer::eventLoop()
                 if (false == flag)
                     LOG_ERROR("%s", "dealclientdata failure");
             }
+            // 协程调度器有新挂起的协程或完成的阻塞任务，统一在本轮最后处理
+            else if (sockfd == coro_scheduler::get_instance()->wake_fd())
+            {
+                coro_scheduler::get_instance()->woken();
+            }
             // //客户端有数据发送的事件发生，处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
@@ -447,13 +624,235 @@ void WebServer::eventLoop()
                 dealwithwrite(sockfd);
             }
         }
+        // ET下上一轮accept用完了预算，已有连接的事件处理完后再accept一批
+        if (m_accept_pending && !listen_ready)
+            dealclinetdata();
+        dealwithcoro();
+        if (timeout)
+        {
+            utils.timer_handler();
+
+            LOG_INFO("%s", "timer tick");
+            //兜底刷盘，避免空闲时日志一直停留在缓冲区
+            if (0 == m_close_log)
+                Log::get_instance()->flush();
+
+            timeout = false;
+        }
+    }
+}
+
+// 把工作线程和本线程请求的接收、发送放进提交队列
+void WebServer::uring_arm_conn(const uring_arm &arm)
+{
+    uring *ring = uring::get_instance();
+    int sockfd = arm.fd;
+    if (arm.ev & EPOLLIN)
+    {
+        int len = 0;
+        char *buf = users[sockfd].recv_buf(len);
+        // 读缓冲区满了还没有完整的请求，与read_once一样关闭连接
+        if (len <= 0)
+        {
+            deal_timer(users_timer[sockfd].timer, sockfd);
+            return;
+        }
+        // 提交队列满了，下一轮再交
+        if (!ring->prep_recv(sockfd, buf, len))
+            ring->arm(sockfd, arm.ev);
+    }
+    else if (arm.ev & EPOLLOUT)
+    {
+        const struct iovec *iov;
+        int count = users[sockfd].send_iov(&iov);
+        if (0 == count)
+        {
+            // 没有要发送的数据，走write的空响应分支重新等待请求
+            users[sockfd].write();
+            return;
+        }
+        users[sockfd].m_trace.begin(TRACE_WRITE_START);
+        if (!ring->prep_send(sockfd, iov, count))
+            ring->arm(sockfd, arm.ev);
+    }
+}
+
+void WebServer::dealwithrecv(int sockfd, int res)
+{
+    // 连接已经在别处关闭，arm请求晚到了一步
+    if (-EBADF == res)
+        return;
+    util_timer *timer = users_timer[sockfd].timer;
+    users[sockfd].fired();
+    users[sockfd].m_trace.begin(TRACE_EPOLL);
+    // 0表示对方关闭连接
+    if (res <= 0)
+    {
+        deal_timer(timer, sockfd);
+        return;
+    }
+    users[sockfd].m_trace.begin(TRACE_READ_START);
+    users[sockfd].recv_done(res);
+    users[sockfd].m_trace.end(TRACE_READ_END);
+    LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+
+    users[sockfd].m_trace.begin(TRACE_ENQUEUE);
+    if (!m_pool->append_p(users + sockfd))
+    {
+        shed_conn(timer, sockfd);
+        return;
+    }
+    if (timer)
+    {
+        adjust_timer(timer);
+    }
+}
+
+void WebServer::dealwithsend(int sockfd, int res, bool last)
+{
+    if (-EBADF == res)
+        return;
+    // 链上前一段没有发完，后一段被取消，剩下的数据重新提交
+    if (-ECANCELED == res)
+    {
+        if (last)
+            uring_arm_conn(uring_arm{sockfd, EPOLLOUT});
+        return;
+    }
+    util_timer *timer = users_timer[sockfd].timer;
+    users[sockfd].fired();
+    if (!users[sockfd].send_done(res))
+    {
+        deal_timer(timer, sockfd);
+        return;
+    }
+    const struct iovec *iov;
+    if (users[sockfd].send_iov(&iov) > 0)
+    {
+        // 内核不支持send的MSG_WAITALL时可能短写，最后一段完成后补发剩下的
+        if (last)
+            uring_arm_conn(uring_arm{sockfd, EPOLLOUT});
+        return;
+    }
+    LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+    //管线化的后续请求已经读到，直接交给线程池
+    if (users[sockfd].pipelined() && !m_pool->append_p(users + sockfd))
+    {
+        shed_conn(timer, sockfd);
+        return;
+    }
+    if (timer)
+    {
+        adjust_timer(timer);
+    }
+}
+
+int WebServer::uring_prep_fixed(int ops)
+{
+    uring *ring = uring::get_instance();
+    int left = 0;
+    if ((ops & 1 << URING_ACCEPT) && !ring->prep_accept(m_listenfd))
+        left |= 1 << URING_ACCEPT;
+    if ((ops & 1 << URING_SIGNAL) && !ring->prep_poll(m_pipefd[0], URING_SIGNAL))
+        left |= 1 << URING_SIGNAL;
+    if ((ops & 1 << URING_CORO) && !ring->prep_poll(coro_scheduler::get_instance()->wake_fd(), URING_CORO))
+        left |= 1 << URING_CORO;
+    if ((ops & 1 << URING_WAKE) && !ring->prep_wake())
+        left |= 1 << URING_WAKE;
+    return left;
+}
+
+void WebServer::eventLoopUring()
+{
+    uring *ring = uring::get_instance();
+    bool timeout = false;
+    bool stop_server = false;
+    std::vector<uring_arm> arms;
+
+    // 监听、信号、唤醒这几个常驻操作里需要（重新）提交的，按1 << URING_OP记录
+    int fixed = 1 << URING_ACCEPT | 1 << URING_SIGNAL | 1 << URING_CORO | 1 << URING_WAKE;
+    while (!stop_server)
+    {
+        // 提交队列满时没交上的留到下一轮
+        if (fixed)
+            fixed = uring_prep_fixed(fixed);
+        ring->take_arms(arms);
+        for (size_t i = 0; i < arms.size(); ++i)
+            uring_arm_conn(arms[i]);
+        // 提交和等待是同一次系统调用，最多等待1秒，保证缓存的时间字符串每秒刷新一次
+        if (ring->submit_and_wait(coro_scheduler::get_instance()->timeout(1000)) < 0)
+        {
+            LOG_ERROR("%s:errno is:%d", "io_uring failure", errno);
+            break;
+        }
+        time_cache::get_instance()->refresh(time(NULL));
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring->peek()) != NULL)
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            bool more = cqe->flags & IORING_CQE_F_MORE;
+            ring->cqe_seen();
+
+            int op = uring::op_of(data);
+            int sockfd = uring::fd_of(data);
+            if (URING_ACCEPT == op)
+            {
+                if (res >= 0)
+                {
+                    // 多发accept共用一个地址缓冲区，地址单独取
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlength = sizeof(client_address);
+                    getpeername(res, (struct sockaddr *)&client_address, &client_addrlength);
+                    addclient(res, client_address);
+                }
+                else
+                    LOG_ERROR("%s:errno is:%d", "accept error", -res);
+                // 监听socket本身有问题时重新提交也是同样的错误，不再空转
+                if (-EINVAL == res || -EBADF == res || -ENOTSOCK == res || -EFAULT == res)
+                {
+                    LOG_ERROR("%s", "listen socket unusable, stop server");
+                    stop_server = true;
+                }
+                else if (!more)
+                    fixed |= 1 << URING_ACCEPT;
+            }
+            else if (URING_SIGNAL == op)
+            {
+                bool flag = dealwithsignal(timeout, stop_server);
+                if (false == flag)
+                    LOG_ERROR("%s", "dealclientdata failure");
+                if (!more)
+                    fixed |= 1 << URING_SIGNAL;
+            }
+            else if (URING_WAKE == op)
+                fixed |= 1 << URING_WAKE;
+            else if (URING_CORO == op)
+            {
+                coro_scheduler::get_instance()->woken();
+                if (!more)
+                    fixed |= 1 << URING_CORO;
+            }
+            // 连接已经关闭，fd可能已经分给了新连接
+            else if (ring->stale(data))
+                continue;
+            else if (URING_RECV == op)
+                dealwithrecv(sockfd, res);
+            else
+                dealwithsend(sockfd, res, URING_SEND_LAST == op);
+        }
+        dealwithcoro();
         if (timeout)
         {
             utils.timer_handler();
 
             LOG_INFO("%s", "timer tick");
+            //兜底刷盘，避免空闲时日志一直停留在缓冲区
+            if (0 == m_close_log)
+                Log::get_instance()->flush();
 
             timeout = false;
         }
     }
-}
\ No newline at end of file
+}
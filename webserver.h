@@ -16,6 +16,12 @@
 #include "./threadpool/threadpool.h"
 // 网络连接处理
 #include "./http/http_conn.h"
+// socket选项
+#include "./net/tcp_tuning.h"
+// io_uring事件后端
+#include "./net/uring.h"
+
+class connection_pool;
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
@@ -29,7 +35,10 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int log_level, int log_flush, int queue_wait,
+              int access_log, int trace_threshold, int credential,
+              int accept_budget, int backlog, int tcp_profile, int compress_mb, int autoindex,
+              int large_file_kb, int queue_target_ms, int db_limit, string rate_limit);
     // 线程池
     void thread_pool();
     void sql_pool();
@@ -40,10 +49,22 @@ public:
     void timer(int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer *timer, int sockfd);
+    // 请求队列满时直接回503并关闭连接
+    void shed_conn(util_timer *timer, int sockfd);
     bool dealclinetdata();
+    bool addclient(int connfd, struct sockaddr_in client_address);
     bool dealwithsignal(bool& timeout, bool& stop_server);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    // 把等到事件的协程所在的连接交回线程池
+    void dealwithcoro();
+    // io_uring后端
+    void eventLoopUring();
+    void uring_arm_conn(const uring_arm &arm);
+    // 提交ops里的常驻操作（按1 << URING_OP），返回没能提交的
+    int uring_prep_fixed(int ops);
+    void dealwithrecv(int sockfd, int res);
+    void dealwithsend(int sockfd, int res, bool last);
 
 public:
     //基础
@@ -51,7 +72,30 @@ public:
     char *m_root;
     int m_log_write;
     int m_close_log;
+    int m_log_level;
+    int m_log_flush;
+    int m_queue_wait;
+    int m_access_log;
+    int m_trace_threshold;
+    int m_credential;
     int m_actormodel;
+    int m_accept_budget;
+    int m_backlog;
+    // ET下accept用完预算时监听队列里还有连接，不会再有新的通知
+    bool m_accept_pending;
+    int m_tcp_profile;
+    tcp_tuning m_tcp;
+    // 压缩响应体缓存，单位MB
+    int m_compress_cache;
+    // 目录请求是否生成列表
+    int m_autoindex;
+    // 按窗口发送的文件大小下限，单位KB
+    int m_large_file;
+    // 准入控制：排队时间目标，单位毫秒；同时进行的数据库请求上限
+    int m_queue_target;
+    int m_db_limit;
+    // 按来源IP限速的规则
+    string m_rate_limit;
 
     // 管道，用于进程通信
     int m_pipefd[2];
@@ -60,7 +104,8 @@ public:
     // http 连接对象
     http_conn *users;
 
-    //数据库相关
+    //凭据存储，mysql后端才会创建数据库连接池
+    credential_store *m_credentials;
     connection_pool *m_connPool;
     string m_user;         //登陆数据库用户名
     string m_passWord;     //登陆数据库密码
@@ -73,6 +118,8 @@ public:
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
+    // 协程调度器取出的可以继续执行的连接
+    std::vector<http_conn *> m_coro_ready;
 
     int m_listenfd;
     int m_OPT_LINGER;